@@ -0,0 +1,46 @@
+/*
+ * capture.h
+ * 
+ * Raw flux capture of host writes to an SCP-style file.
+ * 
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ * 
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#define CAPTURE_FILE "CAPTURE.SCP"
+
+/* Index-delimited segments recorded per write burst. */
+#define CAPTURE_MAX_REVS 5
+
+struct capture_rev {
+    uint32_t duration; /* 25ns units */
+    uint32_t nr_flux;
+};
+
+struct capture;
+
+/* Open the capture file if it exists and is writable. Else NULL. */
+struct capture *capture_open(void);
+
+/* Start, extend, and finish the capture of a write burst on @track. 
+ * Flux is big-endian 16-bit intervals in 25ns units. All but the final 
+ * write should be a multiple of 512 bytes. */
+void capture_begin(struct capture *cap, uint16_t track);
+void capture_write(struct capture *cap, const void *p, uint32_t len);
+void capture_end(struct capture *cap,
+                 const struct capture_rev *rev, unsigned int nr_revs);
+
+/* Drop a write burst that was begun but will not be ended. */
+void capture_abort(struct capture *cap);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
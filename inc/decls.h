@@ -25,6 +25,8 @@
 #include "spi.h"
 #include "timer.h"
 #include "fs.h"
+#include "iostats.h"
+#include "capture.h"
 #include "floppy.h"
 #include "speaker.h"
 #include "touch_panel.h"
@@ -16,18 +16,40 @@
 struct adf_image {
     uint32_t trk_off;
     uint16_t trk_pos, trk_len;
+    uint16_t sec_valid; /* bitmap of cached sectors */
     uint32_t mfm[16], mfm_cons;
 };
 
+/* Cylinders whose track LUT entries are cached at open (one LUT block). */
+#define HFE_TLUT_CYLS 128
+
 struct hfe_image {
     uint16_t tlut_base;
+    struct {
+        uint16_t off, len;
+    } tlut[HFE_TLUT_CYLS];
     uint16_t trk_off;
     uint16_t trk_pos, trk_len;
-    uint32_t ticks_per_cell;
+    uint16_t fill; /* bytes read into the track cache since seek */
+};
+
+/* IBM-MFM track template (see image/mfm.c). Chunks are generated in order: 
+ * pos 0 is the track start, 2n+1 and 2n+2 are the ID and data fields of 
+ * the n'th sector, and the last chunk is the track gap. */
+#define IBM_MAX_SECS 18
+#define IBM_IDAM_LEN 7 /* mark, C, H, R, N, CRC */
+struct ibm_track {
+    uint8_t nr_secs, no, gap3;
+    uint8_t pos; /* next chunk */
+    uint16_t gap4, max_chunk; /* MFM words */
+    uint16_t dam_crc; /* CRC of the data mark, seeding each data CRC */
+    uint16_t pr; /* last raw MFM word emitted */
+    uint16_t idam[IBM_MAX_SECS][IBM_IDAM_LEN]; /* precomputed raw MFM */
 };
 
 struct directaccess {
     uint32_t lba;
+    struct ibm_track trk;
 };
 
 struct image_buf {
@@ -45,6 +67,9 @@ struct image_bufs {
     struct image_buf write_data;
     /* Read buffer for track data to be used for generating flux pattern. */
     struct image_buf read_data;
+    /* Memory shared by read_data and write_data. The write_data staging area
+     * is sized by the image handler and sits at the top of this region. */
+    struct image_buf data;
 };
 
 struct image {
@@ -62,7 +87,16 @@ struct image {
 
     /* Info about current track. */
     uint16_t cur_track;
+    /* Track whose data is held in the read/write data buffer in image-file
+     * layout, coherent with mass storage. Set up by the write path so that
+     * read-after-write is served from RAM. ~0 if no track is cached. */
+    uint16_t cached_track;
     uint32_t tracklen_bc, cur_bc; /* Track length and cursor, in bitcells */
+    /* Bitcell timing, in 'ticks'. Every cell is ticks_per_cell long, and 
+     * ticks_rem in every tracklen_bc cells are one tick longer, spread 
+     * evenly by accumulator ticks_acc. A revolution is then exactly 
+     * DRIVE_MS_PER_REV. See image_set_tracklen_bc(). */
+    uint32_t ticks_per_cell, ticks_rem, ticks_acc;
     uint32_t tracklen_ticks; /* Timing of previous revolution, in 'ticks' */
     uint32_t cur_ticks; /* Offset from index, in 'ticks' */
     uint32_t ticks_since_flux; /* Ticks since last flux sample/reversal */
@@ -84,6 +118,9 @@ struct image_handler {
     uint16_t (*rdata_flux)(struct image *im, uint16_t *tbuf, uint16_t nr);
     void (*write_track)(struct image *im, bool_t flush);
     uint32_t syncword;
+    /* Layout of bitcells in the write_mfm ring: big-endian 32-bit words by 
+     * default, else bytes in stream order, each filled LSB first. */
+    bool_t write_lsb_first;
 };
 
 /* Is given file valid to open as an image? */
@@ -115,12 +152,48 @@ void image_write_track(struct image *im, bool_t flush);
 /* Rotational position of last-generated flux (SYSCLK ticks past index). */
 uint32_t image_ticks_since_index(struct image *im);
 
+/* Is the given track entirely held in RAM? If so it can be streamed without 
+ * waiting on mass storage. */
+bool_t image_track_cached(struct image *im, uint16_t track);
+
+/* Precompute an IBM-MFM track template for the given geometry: sector 
+ * size is 128<<@no bytes, and sector IDs count up from @sec_base. Gap 4 
+ * pads the track to @tracklen_bc bitcells. */
+void ibm_track_init(struct ibm_track *t, uint32_t tracklen_bc,
+                    uint8_t cyl, uint8_t hd, uint8_t sec_base,
+                    uint8_t nr_secs, uint8_t no, uint8_t gap3);
+
+/* Generate the next chunk of template MFM into @mfm, taking sector data 
+ * from @data (sector n at offset n*sector size). Returns FALSE if there is 
+ * not yet space in the MFM ring. */
+bool_t ibm_track_emit(struct ibm_track *t, struct image_buf *mfm,
+                      const uint8_t *data);
+
+/* Set up exact bitcell timing for a track of the given length. */
+void image_set_tracklen_bc(struct image *im, uint32_t tracklen_bc);
+
+/* Move the bitcell cursor, updating cur_ticks and timing state to match. */
+void image_set_cur_bc(struct image *im, uint32_t bc);
+
 void floppy_init(void);
 void floppy_insert(unsigned int unit, struct v2_slot *slot);
 void floppy_cancel(void);
+/* Swap images without tearing down the drive: eject returns the idle 
+ * track-data buffer for use as @scratch_len bytes of scratch space until 
+ * reinsertion. */
+void *floppy_eject(uint32_t scratch_len);
+void floppy_reinsert(struct v2_slot *slot);
 bool_t floppy_handle(void); /* TRUE -> re-read config file */
 void floppy_get_track(uint8_t *p_cyl, uint8_t *p_side);
 
+/* Console diagnostics. */
+void floppy_dump_state(void);
+void floppy_dump_bufs(void);
+void floppy_dump_stats(void);
+void floppy_dump_events(void);
+void floppy_set_audit(bool_t on);
+bool_t floppy_get_audit(void);
+
 /*
  * Local variables:
  * mode: C
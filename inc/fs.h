@@ -18,6 +18,9 @@ FRESULT F_try_open(FIL *fp, const TCHAR *path, BYTE mode);
 void F_open(FIL *fp, const TCHAR *path, BYTE mode);
 void F_close(FIL *fp);
 void F_read(FIL *fp, void *buff, UINT btr, UINT *br);
+/* Read whole sectors from a sector-aligned file position, scattering the 
+ * data across @seg (NULL segment buffers discard their data). */
+void F_read_sg(FIL *fp, const DSEG *seg, UINT nseg);
 void F_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
 void F_sync(FIL *fp);
 void F_lseek(FIL *fp, DWORD ofs);
@@ -27,6 +30,10 @@ void F_readdir(DIR *dp, FILINFO *fno);
 void F_unlink(const TCHAR *path);
 void F_findfirst(DIR *dp, FILINFO *fno, const TCHAR *path,
                  const TCHAR *pattern);
+/* As F_findfirst(), but starting at directory offset @ofs: a value of 
+ * dp->dptr from an earlier search of the same directory. */
+void F_findfrom(DIR *dp, FILINFO *fno, const TCHAR *path,
+                const TCHAR *pattern, DWORD ofs);
 void F_findnext(DIR *dp, FILINFO *fno);
 
 #if 0
@@ -0,0 +1,60 @@
+/*
+ * iostats.h
+ * 
+ * Mass-storage I/O statistics, kept on the mass-storage device itself.
+ * 
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ * 
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#if defined(BOOTLOADER) || defined(RELOADER)
+
+/* The update loaders share the disk drivers, but never save statistics. */
+static inline void iostats_set_device(uint16_t vid, uint16_t pid) {}
+static inline void iostats_set_product(const char *product) {}
+static inline void iostats_read(stk32_time_t start) {}
+static inline void iostats_write(stk32_time_t start) {}
+
+#else
+
+/* Identify the attached device. Resets the statistics. */
+void iostats_set_device(uint16_t vid, uint16_t pid);
+void iostats_set_product(const char *product);
+
+/* Record completion of a mass-storage read or write issued at @start. */
+void iostats_read(stk32_time_t start);
+void iostats_write(stk32_time_t start);
+
+#endif
+
+/* Record floppy-interface timing failures. */
+void iostats_deadline_miss(void);
+void iostats_write_overruns(uint32_t nr);
+
+/* Record a host-visible latency, in microseconds. These are kept for the 
+ * current session only, in log2 bins. */
+#define IOLAT_step_flux     0 /* STEP to read stream start */
+#define IOLAT_side_flux     1 /* SIDE change to read stream start */
+#define IOLAT_wgate_capture 2 /* WGATE to write path accepting flux */
+#define IOLAT_track_read    3 /* a track-data read (floppy_read_data) */
+#define IOLAT_swap_flux     4 /* image swap: reinsertion to first flux */
+#define IOLAT_NR            5
+void iostats_latency(unsigned int type, uint32_t us);
+
+/* Merge with, and write back, the statistics file. Call when idle. */
+void iostats_save(FIL *fp);
+
+/* Print this session's latency counters to the console. */
+void iostats_dump(void);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
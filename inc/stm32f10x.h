@@ -94,6 +94,12 @@ int32_t stk_delta(stk_time_t a, stk_time_t b);
 #define stk_us(x) ((x) * STK_MHZ)
 #define stk_ms(x) stk_us((x) * 1000)
 
+/* SysTick extended to 32 bits by counting its wraps. Same resolution, but 
+ * wraps every ~477s rather than ~1.86s. Counts up. */
+typedef uint32_t stk32_time_t;
+stk32_time_t stk32_now(void);
+#define stk32_diff(x,y) ((y)-(x)) /* d = y - x */
+
 /* NVIC */
 #define IRQx_enable(x) do {                     \
     barrier();                                  \
@@ -45,6 +45,8 @@ struct scb {
     uint32_t bfar;     /* 38: Bus fault address */
 };
 
+#define SCB_ICSR_PENDSTSET     (1u<<26)
+
 #define SCB_CCR_STKALIGN       (1u<<9)
 #define SCB_CCR_BFHFNMIGN      (1u<<8)
 #define SCB_CCR_DIV_0_TRP      (1u<<4)
@@ -17,6 +17,9 @@
 #define ASSERT(p) do { if (0 && (p)) {} } while (0)
 #endif
 
+/* Break the build if @cond, a compile-time constant, is true. */
+#define BUILD_BUG_ON(cond) ((void)sizeof(char[1 - 2*!!(cond)]))
+
 typedef char bool_t;
 #define TRUE 1
 #define FALSE 0
@@ -76,7 +79,14 @@ int snprintf(char *str, size_t size, const char *format, ...)
 #define htobe16(x) _rev16(x)
 #define htobe32(x) _rev32(x)
 
-/* Arena-based memory allocation */
+/* Arena-based memory allocation. The arena is RAM above static data, which 
+ * includes the 1.5kB of IRQ and thread stacks (see the linker script). */
+#if BUILD_GOTEK
+#define RAM_KB 64
+#elif BUILD_TOUCH
+#define RAM_KB 20
+#endif
+#define ARENA_MAX_LEN (RAM_KB*1024 - 1536)
 void *arena_alloc(uint32_t sz);
 uint32_t arena_total(void);
 uint32_t arena_avail(void);
@@ -85,29 +95,61 @@ void arena_init(void);
 /* Board-specific callouts */
 void board_init(void);
 
-#ifndef NDEBUG
+#if !defined(NDEBUG) || defined(CONSOLE_CMDS)
 
 /* Serial console control */
 void console_init(void);
-void console_sync(void);
-void console_crash_on_input(void);
 
-/* Serial console output */
+/* Serial console commands, run from the main loop by console_process(). */
+struct console_cmd {
+    const char *name;
+    const char *help;
+    void (*fn)(int argc, char *argv[]);
+};
+void console_set_cmds(const struct console_cmd *cmds, unsigned int nr);
+void console_process(void);
+
+/* Serial console output. In release builds (CONSOLE_CMDS) this is silent 
+ * except while console_process() is echoing input or running a command. */
 int vprintk(const char *format, va_list ap)
     __attribute__ ((format (printf, 1, 0)));
 int printk(const char *format, ...)
     __attribute__ ((format (printf, 1, 2)));
 
-#else /* NDEBUG */
+#else
 
 #define console_init() ((void)0)
-#define console_sync() IRQ_global_disable()
-#define console_crash_on_input() ((void)0)
+#define console_set_cmds(cmds, nr) ((void)0)
+#define console_process() ((void)0)
 static inline int vprintk(const char *format, va_list ap) { return 0; }
 static inline int printk(const char *format, ...) { return 0; }
 
 #endif
 
+#ifndef NDEBUG
+
+void console_sync(void);
+void console_crash_on_input(void);
+
+/* Routine diagnostics, filtered by the console's "trace" level. */
+extern uint8_t trace_level;
+#define trace(lvl, f, a...) do {                \
+    if (trace_level >= (lvl))                   \
+        printk(f, ## a);                        \
+} while (0)
+
+#else /* NDEBUG */
+
+#define console_sync() IRQ_global_disable()
+#define console_crash_on_input() ((void)0)
+#define trace(lvl, f, a...) do { if (0) printk(f, ## a); } while (0)
+
+#endif
+
+#define TRACE_QUIET   0 /* errors only */
+#define TRACE_DEFAULT 1 /* per-track activity */
+#define TRACE_VERBOSE 2 /* per-seek activity */
+
 /* CRC-CCITT */
 uint16_t crc16_ccitt(const void *buf, size_t len, uint16_t crc);
 
@@ -124,6 +166,7 @@ extern uint8_t display_mode;
 bool_t led_3dig_init(void);
 void led_3dig_write(const char *p);
 void led_3dig_display_setting(bool_t enable);
+void led_3dig_sync(void);
 
 /* Gotek: I2C 16x2 LCD */
 bool_t lcd_init(void);
@@ -143,6 +186,7 @@ bool_t usbh_msc_connected(void);
 static inline bool_t led_3dig_init(void) { return FALSE; }
 static inline void led_3dig_write(const char *p) {}
 static inline void led_3dig_display_setting(bool_t enable) {}
+static inline void led_3dig_sync(void) {}
 
 static inline bool_t lcd_init(void) { return FALSE; }
 static inline void lcd_clear(void) {}
@@ -187,7 +231,10 @@ void EXC_unused(void);
 #define RDATA_IRQ_PRI         8
 #define FLOPPY_IRQ_LO_PRI     9
 #define I2C_IRQ_PRI          13
+#define LED_IRQ_PRI          13
 #define USB_IRQ_PRI          14
+#define TOUCH_IRQ_PRI        15
+#define CONSOLE_IRQ_PRI      15 /* release builds; debug builds use RESET */
 
 /*
  * Local variables:
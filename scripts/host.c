@@ -0,0 +1,229 @@
+/*
+ * host.c
+ *
+ * Host stand-ins for the firmware services that image handlers use: FatFS
+ * wrappers over host files, direct-access sectors, console output.
+ *
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ *
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/fatfs/diskio.h"
+
+uint32_t host_stk;
+uint8_t trace_level = TRACE_QUIET;
+void (*host_io)(unsigned int bytes);
+
+static FILE *files[4];
+static unsigned int nr_files;
+static FILE *disk;
+
+void host_illegal(const char *file, int line)
+{
+    host_fail("ASSERT failed at %s:%d", file, line);
+}
+
+void host_fail(const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    printf("FAIL: ");
+    vprintf(format, ap);
+    printf("\n");
+    va_end(ap);
+    exit(1);
+}
+
+int vprintk(const char *format, va_list ap)
+{
+    return getenv("V") ? vprintf(format, ap) : 0;
+}
+
+int printk(const char *format, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vprintk(format, ap);
+    va_end(ap);
+
+    return n;
+}
+
+void filename_extension(const char *filename, char *extension, size_t size)
+{
+    const char *p = strrchr(filename, '.');
+    unsigned int i;
+
+    extension[0] = '\0';
+    if (p == NULL)
+        return;
+
+    for (i = 0; i < (size-1); i++)
+        if ((extension[i] = tolower(p[i+1])) == '\0')
+            break;
+    extension[i] = '\0';
+}
+
+bool_t host_open_image(const char *path, struct v2_slot *slot,
+                       bool_t writable)
+{
+    const char *ext = strrchr(path, '.');
+    FILE *f;
+
+    if ((nr_files == ARRAY_SIZE(files)) || (ext == NULL)
+        || ((f = fopen(path, writable ? "r+b" : "rb")) == NULL))
+        return FALSE;
+
+    memset(slot, 0, sizeof(*slot));
+    slot->type[0] = tolower(ext[1]);
+    slot->type[1] = tolower(ext[2]);
+    slot->type[2] = tolower(ext[3]);
+    snprintf(slot->name, sizeof(slot->name), "%s", path);
+    fseek(f, 0, SEEK_END);
+    slot->size = ftell(f);
+    slot->firstCluster = nr_files;
+    files[nr_files++] = f;
+
+    return TRUE;
+}
+
+void host_close_images(void)
+{
+    while (nr_files)
+        fclose(files[--nr_files]);
+}
+
+void host_set_disk(const char *path)
+{
+    if (disk != NULL)
+        fclose(disk);
+    disk = path ? fopen(path, "rb") : NULL;
+}
+
+void fatfs_from_slot(FIL *file, const struct v2_slot *slot, BYTE mode)
+{
+    memset(file, 0, sizeof(*file));
+    file->obj.sclust = slot->firstCluster;
+    file->obj.objsize = slot->size;
+    file->flag = mode;
+}
+
+static FILE *host_file(FIL *fp)
+{
+    if (fp->obj.sclust >= nr_files)
+        host_fail("Bad file handle %u", (unsigned int)fp->obj.sclust);
+    return files[fp->obj.sclust];
+}
+
+/* Read up to @btr bytes at the file position, zero-filling past EOF. */
+static UINT host_read(FIL *fp, void *buff, UINT btr)
+{
+    FILE *f = host_file(fp);
+    UINT br = 0;
+
+    if (fp->fptr < fp->obj.objsize) {
+        fseek(f, fp->fptr, SEEK_SET);
+        br = fread(buff, 1, btr, f);
+    }
+    memset((char *)buff + br, 0, btr - br);
+    fp->fptr += br;
+    return br;
+}
+
+static void io(unsigned int bytes)
+{
+    if (host_io != NULL)
+        (*host_io)(bytes);
+}
+
+void F_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+    UINT _br;
+
+    io(btr);
+    _br = host_read(fp, buff, btr);
+    if (br != NULL)
+        *br = _br;
+}
+
+void F_read_sg(FIL *fp, const DSEG *seg, UINT nseg)
+{
+    static BYTE discard[512];
+    UINT n;
+
+    for (n = 0; n < nseg; n++)
+        io(seg[n].len);
+
+    for (; nseg != 0; seg++, nseg--) {
+        if (seg->buff != NULL) {
+            host_read(fp, seg->buff, seg->len);
+            continue;
+        }
+        for (n = 0; n < seg->len; n += sizeof(discard))
+            host_read(fp, discard, min_t(UINT, sizeof(discard), seg->len - n));
+    }
+}
+
+void F_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+    FILE *f = host_file(fp);
+
+    io(btw);
+    if (fseek(f, fp->fptr, SEEK_SET)
+        || (fwrite(buff, 1, btw, f) != btw))
+        host_fail("Image write at offset %u", (unsigned int)fp->fptr);
+    fp->fptr += btw;
+    if (fp->fptr > fp->obj.objsize)
+        fp->obj.objsize = fp->fptr;
+    if (bw != NULL)
+        *bw = btw;
+}
+
+void F_sync(FIL *fp)
+{
+}
+
+void F_lseek(FIL *fp, DWORD ofs)
+{
+    fp->fptr = ofs;
+}
+
+void F_die(void)
+{
+    host_fail("F_die()");
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    size_t n = 0;
+
+    io(count * 512);
+    if (disk != NULL) {
+        fseek(disk, sector * 512, SEEK_SET);
+        n = fread(buff, 1, count * 512, disk);
+    }
+    memset(buff + n, 0, count * 512 - n);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    host_fail("Direct-access write to sector %u", (unsigned int)sector);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,60 @@
+/*
+ * host.h
+ *
+ * Build firmware sources on the host, for the tests run by host_test.sh.
+ * Force-included after decls.h: replaces the ARM intrinsics and device
+ * registers that firmware code reaches through macros.
+ *
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ *
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+/* Failed ASSERT()s report and exit, rather than hit an undefined opcode. */
+void host_illegal(const char *file, int line) __attribute__((noreturn));
+#undef illegal
+#define illegal() host_illegal(__FILE__, __LINE__)
+
+/* SysTick is a plain counter, which tests advance as they please. */
+extern uint32_t host_stk;
+#undef stk_now
+#define stk_now() (host_stk & STK_MASK)
+
+#undef be16toh
+#undef be32toh
+#undef htobe16
+#undef htobe32
+#define be16toh(x) __builtin_bswap16(x)
+#define be32toh(x) __builtin_bswap32(x)
+#define htobe16(x) __builtin_bswap16(x)
+#define htobe32(x) __builtin_bswap32(x)
+
+/* Image files are host files. The slot's firstCluster is the host file
+ * index returned by host_open_image(), and the FIL tracks only size and
+ * position. Writes to an image not opened @writable fail the test. */
+bool_t host_open_image(const char *path, struct v2_slot *slot,
+                       bool_t writable);
+void host_close_images(void);
+
+/* If set, called with the size of every image and direct-access read or 
+ * write, before it completes. */
+extern void (*host_io)(unsigned int bytes);
+
+/* Direct-access sectors: 512-byte sectors of a host file, or zeroes. */
+void host_set_disk(const char *path);
+
+/* Report a test failure and exit. F_* errors end up here too: the host 
+ * has no cancellation to unwind to. */
+void host_fail(const char *format, ...)
+    __attribute__((noreturn, format(printf, 1, 2)));
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Build the image handlers (src/image) with the host compiler, against the
+# stand-ins in scripts/host.c, and run the scripts/test_*.c tests that
+# exercise them. Then replay each scripts/replay_*.txt bus trace through
+# scripts/replay.c, which runs src/floppy.c against models of its
+# peripherals. Name tests to run only those: host_test.sh tracklen replay
+set -eo pipefail
+cd "$(dirname "$0")/.."
+out=$(mktemp -d)
+trap 'rm -rf $out' EXIT
+CFLAGS="-O2 -g -std=gnu99 -Wall -Werror -Wno-format -fno-builtin"
+CFLAGS+=" -fno-strict-aliasing -Wno-unused-value -iquote inc -I src/fatfs"
+CFLAGS+=" -DBUILD_GOTEK=1 -include decls.h -include scripts/host.h"
+for f in src/image/*.c src/crc.c scripts/host.c; do
+    ${CC:-gcc} $CFLAGS -c $f -o $out/$(basename $f .c).o
+done
+ar rcs $out/fw.a $out/*.o
+tests="$@"
+[ -n "$tests" ] || tests="$(ls scripts/test_*.c | sed 's|.*/test_\(.*\)\.c|\1|') replay"
+for t in $tests; do
+    if [ "$t" = replay ]; then
+        ${CC:-gcc} $CFLAGS -o $out/replay scripts/replay.c $out/fw.a
+        for f in scripts/replay_*.txt; do
+            $out/replay -c $f | tail -n 1
+        done
+        continue
+    fi
+    ${CC:-gcc} $CFLAGS -o $out/$t scripts/test_$t.c $out/fw.a
+    $out/$t
+done
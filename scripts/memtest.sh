@@ -0,0 +1,12 @@
+#!/bin/bash
+# Build scripts/memtest.c against src/util.c with the host compiler, and run
+# it. Pass -b to also time each function against a bytewise reference.
+# Loop-idiom recognition is disabled so the compiler cannot turn util.c's
+# loops back into calls to the host C library.
+set -e
+cd "$(dirname "$0")/.."
+out=$(mktemp)
+trap 'rm -f $out' EXIT
+${CC:-gcc} -O2 -std=gnu99 -Wall -fno-builtin -fno-strict-aliasing \
+    -fno-tree-loop-distribute-patterns -o $out scripts/memtest.c
+$out "$@"
@@ -5,6 +5,19 @@
 #  2 bytes: 'FY'
 #  2 bytes: CRC16-CCITT, seed 0xFFFF, stored big endian
 # 
+# With -z the above is compressed into the following format:
+#  M bytes: <LZSS stream, decompressing to the above>
+#  2 bytes: 'FZ'
+#  2 bytes: CRC16-CCITT, seed 0xFFFF, stored big endian
+#
+# The LZSS stream is a sequence of groups, each a flag byte followed by
+# up to 8 tokens. Flag bits are consumed LSB first: a set bit denotes a
+# literal byte; a clear bit denotes a 2-byte match (distance-1 in the low
+# byte and high nibble of the second byte, length-3 in its low nibble).
+# The bootloader decompresses through a 4kB window as it reads the file.
+#
+# Usage: mk_update.py [-z] <input> <output>
+# 
 # Written & released by Keir Fraser <keir.xen@gmail.com>
 # 
 # This is free and unencumbered software released into the public domain.
@@ -13,20 +26,73 @@
 import crcmod.predefined
 import struct, sys
 
+WINDOW = 4096
+MIN_MATCH = 3
+MAX_MATCH = 18
+MAX_CHAIN = 256
+
+def crc_footer(dat, sig):
+    crc16 = crcmod.predefined.Crc('crc-ccitt-false')
+    dat = bytes(dat) + sig
+    crc16.update(dat)
+    return dat + struct.pack(">H", crc16.crcValue)
+
+def compress(dat):
+    dat = bytearray(dat)
+    n = len(dat)
+    out = bytearray()
+    chains = {}
+    i = 0
+    while i < n:
+        flag_pos = len(out)
+        out.append(0)
+        for bit in range(8):
+            if i >= n:
+                break
+            # Greedy search for the longest match in the window.
+            best_len, best_dist = 0, 0
+            max_len = min(MAX_MATCH, n - i)
+            if max_len >= MIN_MATCH:
+                for j in reversed(chains.get(bytes(dat[i:i+3]), [])):
+                    if i - j > WINDOW:
+                        break
+                    l = MIN_MATCH
+                    while l < max_len and dat[j+l] == dat[i+l]:
+                        l += 1
+                    if l > best_len:
+                        best_len, best_dist = l, i - j
+                        if l == max_len:
+                            break
+            if best_len >= MIN_MATCH:
+                d = best_dist - 1
+                out += bytearray([d & 0xff,
+                                  ((d >> 4) & 0xf0) | (best_len - MIN_MATCH)])
+                step = best_len
+            else:
+                out[flag_pos] |= 1 << bit
+                out.append(dat[i])
+                step = 1
+            for k in range(i, min(i + step, n - 2)):
+                chain = chains.setdefault(bytes(dat[k:k+3]), [])
+                chain.append(k)
+                if len(chain) > 2*MAX_CHAIN:
+                    del chain[:MAX_CHAIN]
+            i += step
+    return out
+
 def main(argv):
+    compressed = (len(argv) > 1 and argv[1] == '-z')
+    if compressed:
+        argv = argv[1:]
     in_f = open(argv[1], "rb")
     out_f = open(argv[2], "wb")
     in_dat = in_f.read()
     in_len = len(in_dat)
     assert (in_len & 3) == 0, "input is not longword padded"
-    crc16 = crcmod.predefined.Crc('crc-ccitt-false')
-    out_f.write(in_dat)
-    crc16.update(in_dat)
-    in_dat = struct.pack("cc", 'F', 'Y')
-    out_f.write(in_dat)
-    crc16.update(in_dat)
-    in_dat = struct.pack(">H", crc16.crcValue)
-    out_f.write(in_dat)
+    out_dat = crc_footer(in_dat, b'FY')
+    if compressed:
+        out_dat = crc_footer(compress(out_dat), b'FZ')
+    out_f.write(out_dat)
 
 if __name__ == "__main__":
     main(sys.argv)
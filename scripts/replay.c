@@ -0,0 +1,717 @@
+/*
+ * replay.c
+ *
+ * Replay a host's floppy bus activity against the firmware's drive
+ * emulation. src/floppy.c and src/timer.c run on the host, against models
+ * of the GPIO, EXTI, DMA and timer peripherals they drive and of the NVIC
+ * that dispatches their IRQs, on a virtual clock. The host's step, side and
+ * write-gate edges come from a trace in the format printed by the console
+ * "events" command:
+ *
+ *   <us> us: step <1 = inward>
+ *   <us> us: side <head>
+ *   <us> us: wgate on <track>
+ *   <us> us: wgate off 0
+ *
+ * where <us> is the time since the previous line. The other lines of an
+ * events log are the drive's responses: they are skipped, except to keep
+ * time. '#' starts a comment. The trace starts once the image has been
+ * inserted and streaming for LEAD_IN_MS.
+ *
+ * Output is the firmware's own events log over the replay, in the same
+ * format, followed by the latencies passed to iostats and the drive
+ * statistics.
+ *
+ * This is a logical model, not a cycle-accurate one: firmware code takes no
+ * virtual time, except in busy-waits and delay_us(). Each floppy_handle()
+ * pass costs MAIN_LOOP_US, and each mass-storage access costs the given
+ * access latency plus 1us per byte (USB full speed). Written flux is a
+ * random run of legal DD MFM intervals.
+ *
+ * Usage: replay [-c] [-l <access us>] <trace> [<image>]
+ *  -c: Fail on any RDATA underrun, missed write or MFM overflow, or if the
+ *      read stream is not running on the host's track at the end.
+ * The image is copied, so that writes do not modify it. Without one, an
+ * ADF of pseudo-random data is used.
+ *
+ * Run by host_test.sh on each scripts/replay_*.txt, with -c.
+ *
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ *
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+char *strchr(const char *s, int c);
+size_t strlen(const char *s);
+
+#define LEAD_IN_MS   500 /* insertion to trace start */
+#define LEAD_OUT_MS  500 /* last trace event to end of replay */
+#define MAIN_LOOP_US  10
+
+/* Peripheral registers are plain memory: the models below act on them. */
+static volatile struct gpio sim_gpioa, sim_gpiob;
+static volatile struct afio sim_afio;
+static volatile struct exti sim_exti;
+static volatile struct dma sim_dma1;
+static volatile struct tim sim_tim1, sim_tim3, sim_tim4;
+#define gpioa (&sim_gpioa)
+#define gpiob (&sim_gpiob)
+#define afio (&sim_afio)
+#define exti (&sim_exti)
+#define dma1 (&sim_dma1)
+#define tim1 (&sim_tim1)
+#define tim3 (&sim_tim3)
+#define tim4 (&sim_tim4)
+
+/* NVIC and core: IRQ enable, pending and priority, BASEPRI and PRIMASK.
+ * Any of these may let a pending IRQ in, and a busy-wait lets time pass. */
+static uint8_t sim_prio[64];
+static void sim_irq_enable(unsigned int irq, bool_t on);
+static void sim_irq_pend(unsigned int irq, bool_t on);
+static uint32_t sim_irq_save(uint8_t pri);
+static void sim_irq_restore(uint32_t basepri);
+static void sim_irq_global(bool_t on);
+static void sim_relax(void);
+static uint32_t sim_rbit32(uint32_t x);
+#undef IRQx_enable
+#undef IRQx_disable
+#undef IRQx_set_pending
+#undef IRQx_clear_pending
+#undef IRQx_set_prio
+#undef IRQ_save
+#undef IRQ_restore
+#undef IRQ_global_disable
+#undef IRQ_global_enable
+#undef cpu_relax
+#undef cpu_sync
+#undef cmpxchg
+#define IRQx_enable(x) sim_irq_enable(x, TRUE)
+#define IRQx_disable(x) sim_irq_enable(x, FALSE)
+#define IRQx_set_pending(x) sim_irq_pend(x, TRUE)
+#define IRQx_clear_pending(x) sim_irq_pend(x, FALSE)
+#define IRQx_set_prio(x,y) (sim_prio[x] = (y))
+#define IRQ_save(newpri) sim_irq_save(newpri)
+#define IRQ_restore(oldpri) sim_irq_restore(oldpri)
+#define IRQ_global_disable() sim_irq_global(FALSE)
+#define IRQ_global_enable() sim_irq_global(TRUE)
+#define cpu_relax() sim_relax()
+#define cpu_sync() barrier()
+#define cmpxchg(ptr,o,n) __sync_val_compare_and_swap(ptr, o, n)
+#define _rbit32(x) sim_rbit32(x)
+
+/* The Gotek SELA fast path is Thumb assembly, placed in SRAM: compile it
+ * out, and let its C half live in .text. sim_sela() takes IRQ 6 instead. */
+#define asm(s) static const char sela_asm[] __attribute__((unused)) = s
+#define section(s) used
+uint32_t gpio_out_active, gpio_out_setreset;
+
+#include "../src/timer.c"
+#include "../src/floppy.c"
+
+#undef asm
+#undef section
+
+#define NO_IRQ 0xff
+
+/* A host bus edge: a pin of gpioa (port 0) or gpiob (port 1) goes to
+ * @level, and raises EXTI @irq. */
+struct sim_edge {
+    uint64_t time;
+    uint8_t port, pin, level, irq;
+};
+
+static struct {
+    uint64_t now; /* SYSCLK ticks */
+    /* NVIC and core. */
+    uint64_t enabled, pending;
+    uint8_t basepri; /* as the BASEPRI register: priority << 4, or 0 */
+    bool_t primask;
+    unsigned int exec_pri; /* running handler's priority, or 16 */
+    /* RDATA: TIM3 takes each ARR value from the DMA ring at update. */
+    struct {
+        bool_t on;
+        uint64_t prev, next; /* last and next update events */
+    } rd;
+    /* WDATA: TIM1 captures host flux into the DMA ring while WGATE is on. */
+    struct {
+        bool_t on, gate;
+        uint64_t base, next; /* counter reset, and next flux */
+        uint32_t rnd;
+    } wr;
+    /* TIM4: timer.c's one-shot deadline. */
+    struct {
+        bool_t on;
+        uint64_t deadline;
+    } timer4;
+    /* The trace, as host bus edges. */
+    struct sim_edge *edges;
+    unsigned int nr_edges, next_edge;
+    uint64_t t0, end;
+    /* Mass-storage access cost. */
+    uint32_t access_us;
+    /* Firmware event log, printed from trace start. */
+    uint32_t ev_cons;
+    uint64_t ev_prev;
+    /* iostats. */
+    struct {
+        uint32_t nr, max;
+        uint64_t sum;
+    } lat[IOLAT_NR];
+    uint32_t deadline_misses;
+} sim = { .exec_pri = 16, .access_us = 1000 };
+
+static void sim_run(uint64_t until);
+
+static void sim_set_time(uint64_t t)
+{
+    if (t <= sim.now)
+        return;
+    sim.now = t;
+    host_stk = -(uint32_t)(sim.now / (SYSCLK_MHZ/STK_MHZ));
+    if (sim.rd.on)
+        tim_rdata->cnt = sim.now - sim.rd.prev;
+}
+
+stk32_time_t stk32_now(void)
+{
+    return sim.now / (SYSCLK_MHZ/STK_MHZ);
+}
+
+void delay_us(unsigned int us)
+{
+    sim_run(sim.now + sysclk_us(us));
+}
+
+static void sim_relax(void)
+{
+    sim_run(sim.now + sysclk_us(1));
+}
+
+static uint32_t sim_rbit32(uint32_t x)
+{
+    uint32_t y = 0;
+    unsigned int i;
+    for (i = 0; i < 32; i++, x >>= 1)
+        y = (y << 1) | (x & 1);
+    return y;
+}
+
+/* Mass storage: charged on each access, by scripts/host.c. */
+static void sim_io(unsigned int bytes)
+{
+    sim_run(sim.now + sysclk_us(sim.access_us + bytes));
+}
+
+/* Register writes take effect: start and stop the DMA-driven timers, and
+ * (re)arm the deadline timer. */
+static void sim_poll(void)
+{
+    bool_t on;
+
+    on = (dma_rdata.ccr & DMA_CCR_EN) && (tim_rdata->cr1 & TIM_CR1_CEN);
+    if (on && !sim.rd.on)
+        sim.rd.next = sim.now; /* EGR.UG: immediate update */
+    sim.rd.on = on;
+    tim_rdata->egr = 0;
+
+    if (tim_wdata->egr & TIM_EGR_UG)
+        sim.wr.base = sim.now;
+    tim_wdata->egr = 0;
+    sim.wr.on = (dma_wdata.ccr & DMA_CCR_EN) && (tim_wdata->cr1 & TIM_CR1_CEN);
+
+    if (tim4->egr & TIM_EGR_UG)
+        sim.timer4.deadline = sim.now
+            + (uint64_t)(tim4->psc + 1) * (tim4->arr + 1);
+    tim4->egr = 0;
+    sim.timer4.on = !!(tim4->cr1 & TIM_CR1_CEN);
+}
+
+static void sim_sela(void)
+{
+    gpio_out->bsrr = gpio_out_active << (drive.sel ? 0 : 16);
+    _IRQ_SELA_changed(gpio_out_active);
+}
+
+static void (*const sim_vector[64])(void) = {
+    [6] = sim_sela, [7] = IRQ_7, [10] = IRQ_10, [12] = IRQ_12,
+    [13] = IRQ_13, [23] = IRQ_23, [30] = IRQ_30, [43] = IRQ_43
+};
+
+/* Take the pending IRQs that the current priority lets in, best first. */
+static void sim_dispatch(void)
+{
+    unsigned int irq, best, limit, prev;
+    uint64_t ready;
+
+    for (;;) {
+        sim_poll();
+        limit = sim.primask ? 0 : sim.exec_pri;
+        if (sim.basepri && ((sim.basepri >> 4) < limit))
+            limit = sim.basepri >> 4;
+        ready = sim.pending & sim.enabled;
+        best = 64;
+        for (irq = 0; irq < 64; irq++)
+            if (((ready >> irq) & 1)
+                && ((best == 64) || (sim_prio[irq] < sim_prio[best])))
+                best = irq;
+        if ((best == 64) || (sim_prio[best] >= limit))
+            return;
+        sim.pending &= ~(1ull << best);
+        if (sim_vector[best] == NULL)
+            host_fail("IRQ %u has no handler", best);
+        prev = sim.exec_pri;
+        sim.exec_pri = sim_prio[best];
+        (*sim_vector[best])();
+        sim.exec_pri = prev;
+    }
+}
+
+static void sim_irq_enable(unsigned int irq, bool_t on)
+{
+    if (on)
+        sim.enabled |= 1ull << irq;
+    else
+        sim.enabled &= ~(1ull << irq);
+    sim_dispatch();
+}
+
+static void sim_irq_pend(unsigned int irq, bool_t on)
+{
+    if (on)
+        sim.pending |= 1ull << irq;
+    else
+        sim.pending &= ~(1ull << irq);
+    sim_dispatch();
+}
+
+static uint32_t sim_irq_save(uint8_t pri)
+{
+    uint8_t oldpri = sim.basepri;
+    pri <<= 4;
+    if (!oldpri || (oldpri > pri))
+        sim.basepri = pri;
+    return oldpri;
+}
+
+static void sim_irq_restore(uint32_t basepri)
+{
+    sim.basepri = basepri;
+    sim_dispatch();
+}
+
+static void sim_irq_global(bool_t on)
+{
+    sim.primask = !on;
+    sim_dispatch();
+}
+
+/* A circular DMA channel of @n entries moves one: half- and full-transfer
+ * interrupts. */
+static void sim_dma_count(volatile struct dma_chn *ch, unsigned int n,
+                          unsigned int irq)
+{
+    if (--ch->cndtr == 0) {
+        ch->cndtr = n;
+        if (ch->ccr & DMA_CCR_TCIE)
+            sim.pending |= 1ull << irq;
+    } else if ((ch->cndtr == n/2) && (ch->ccr & DMA_CCR_HTIE)) {
+        sim.pending |= 1ull << irq;
+    }
+}
+
+/* RDATA update event: the next flux interval is loaded into ARR. */
+static void sim_rdata_update(void)
+{
+    const unsigned int n = ARRAY_SIZE(dma_rd->buf);
+
+    tim_rdata->arr = dma_rd->buf[n - dma_rdata.cndtr];
+    tim_rdata->cnt = 0;
+    sim_dma_count(&dma_rdata, n, dma_rdata_irq);
+    sim.rd.prev = sim.now;
+    sim.rd.next = sim.now + tim_rdata->arr + 1;
+}
+
+/* A host flux transition on WDATA: captured if TIM1 and its DMA are on.
+ * Intervals are 2, 3 or 4 DD bitcells. */
+static void sim_wdata_flux(void)
+{
+    const unsigned int n = ARRAY_SIZE(dma_wr->buf);
+
+    if (sim.wr.on) {
+        tim_wdata->ccr1 = sim.now - sim.wr.base;
+        dma_wr->buf[n - dma_wdata.cndtr] = tim_wdata->ccr1;
+        sim_dma_count(&dma_wdata, n, dma_wdata_irq);
+    }
+    sim.wr.rnd = sim.wr.rnd * 1103515245u + 12345u;
+    sim.wr.next = sim.now + sysclk_us(2) * (2 + (sim.wr.rnd >> 16) % 3);
+}
+
+static void sim_edge(const struct sim_edge *e)
+{
+    volatile struct gpio *gpio = e->port ? gpiob : gpioa;
+
+    if (e->level)
+        gpio->idr |= m(e->pin);
+    else
+        gpio->idr &= ~m(e->pin);
+
+    if ((gpio == gpiob) && (e->pin == pin_wgate)) {
+        sim.wr.gate = !e->level;
+        sim.wr.next = sim.now + sysclk_us(8);
+    }
+
+    if ((e->irq != NO_IRQ) && (exti->imr & m(e->pin))) {
+        exti->pr |= m(e->pin);
+        sim.pending |= 1ull << e->irq;
+    }
+}
+
+static uint64_t sim_next(void)
+{
+    uint64_t t = UINT64_MAX;
+
+    if (sim.next_edge < sim.nr_edges)
+        t = min(t, sim.edges[sim.next_edge].time);
+    if (sim.rd.on)
+        t = min(t, sim.rd.next);
+    if (sim.wr.gate)
+        t = min(t, sim.wr.next);
+    if (sim.timer4.on)
+        t = min(t, sim.timer4.deadline);
+
+    return t;
+}
+
+/* Advance virtual time to @until, through each peripheral event and the
+ * IRQs it raises. Handlers may busy-wait, and so nest. */
+static void sim_run(uint64_t until)
+{
+    uint64_t t;
+
+    sim_poll();
+    while ((t = sim_next()) <= until) {
+        sim_set_time(t);
+        if ((sim.next_edge < sim.nr_edges)
+            && (sim.edges[sim.next_edge].time <= sim.now))
+            sim_edge(&sim.edges[sim.next_edge++]);
+        if (sim.rd.on && (sim.rd.next <= sim.now))
+            sim_rdata_update();
+        if (sim.wr.gate && (sim.wr.next <= sim.now))
+            sim_wdata_flux();
+        if (sim.timer4.on && (sim.timer4.deadline <= sim.now)) {
+            tim4->cr1 &= ~TIM_CR1_CEN; /* one-pulse mode */
+            tim4->sr |= TIM_SR_UIF;
+            sim.timer4.on = FALSE;
+            if (tim4->dier & TIM_DIER_UIE)
+                sim.pending |= 1ull << TIMER_IRQ;
+        }
+        sim_dispatch();
+    }
+    sim_set_time(until);
+}
+
+/* Firmware services used by floppy.c. */
+
+void gpio_configure_pin(GPIO gpio, unsigned int pin, unsigned int mode)
+{
+}
+
+void speaker_pulse(void)
+{
+}
+
+struct capture *capture_open(void)
+{
+    return NULL;
+}
+
+void capture_begin(struct capture *cap, uint16_t track) {}
+void capture_write(struct capture *cap, const void *p, uint32_t len) {}
+void capture_end(struct capture *cap,
+                 const struct capture_rev *rev, unsigned int nr_revs) {}
+void capture_abort(struct capture *cap) {}
+
+/* Gotek RAM less the firmware's static data: 32kB of track data. */
+static uint32_t sim_arena[(WRITE_MFM_LEN + 2*sizeof(struct dma_ring)
+                           + sizeof(struct image) + 32*1024) / 4];
+static char *sim_arena_p;
+
+void arena_init(void)
+{
+    sim_arena_p = (char *)sim_arena;
+}
+
+void *arena_alloc(uint32_t sz)
+{
+    void *p = sim_arena_p;
+    sim_arena_p += (sz + 3) & ~3;
+    ASSERT(sim_arena_p <= (char *)sim_arena + sizeof(sim_arena));
+    return p;
+}
+
+uint32_t arena_avail(void)
+{
+    return (char *)sim_arena + sizeof(sim_arena) - sim_arena_p;
+}
+
+void iostats_latency(unsigned int type, uint32_t us)
+{
+    sim.lat[type].nr++;
+    sim.lat[type].sum += us;
+    sim.lat[type].max = max(sim.lat[type].max, us);
+}
+
+void iostats_deadline_miss(void)
+{
+    sim.deadline_misses++;
+}
+
+/* Also counted in floppy_stats. */
+void iostats_write_overruns(uint32_t nr)
+{
+}
+
+/* Print the firmware's events logged since last time, from trace start. */
+static void sim_print_events(void)
+{
+    static const char *names[] = {
+        "step", "side", "wgate on", "wgate off",
+        "flux", "underrun", "missed write"
+    };
+    struct bus_event *e;
+    uint64_t t;
+
+    if ((events.prod - sim.ev_cons) > ARRAY_SIZE(events.ev)) {
+        printf("# %u events lost\n",
+               events.prod - sim.ev_cons - ARRAY_SIZE(events.ev));
+        sim.ev_cons = events.prod - ARRAY_SIZE(events.ev);
+    }
+
+    for (; sim.ev_cons != events.prod; sim.ev_cons++) {
+        e = &events.ev[sim.ev_cons & (ARRAY_SIZE(events.ev)-1)];
+        t = sim.now - (uint64_t)stk_diff(e->time, stk_now())
+            * (SYSCLK_MHZ/STK_MHZ);
+        if (t < sim.t0)
+            continue;
+        printf("%d us: %s %u\n",
+               (int)((int64_t)(t - sim.ev_prev) / SYSCLK_MHZ),
+               names[e->type], e->arg);
+        sim.ev_prev = t;
+    }
+}
+
+static void sim_add_edge(uint64_t time, uint8_t port, uint8_t pin,
+                         uint8_t level, uint8_t irq)
+{
+    struct sim_edge *e;
+    unsigned int i;
+
+    sim.edges = realloc(sim.edges, (sim.nr_edges+1) * sizeof(*e));
+    for (i = sim.nr_edges++; (i > 0) && (sim.edges[i-1].time > time); i--)
+        sim.edges[i] = sim.edges[i-1];
+    e = &sim.edges[i];
+    e->time = time;
+    e->port = port;
+    e->pin = pin;
+    e->level = level;
+    e->irq = irq;
+}
+
+static void sim_load_trace(const char *path)
+{
+    char line[256], name[32], *p;
+    unsigned int nr = 0, arg;
+    int64_t t = 0;
+    int us;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL)
+        host_fail("Cannot open %s", path);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        nr++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        for (p = line; (*p == ' ') || (*p == '\t') || (*p == '\n'); p++)
+            continue;
+        if (*p == '\0')
+            continue;
+        if (sscanf(line, " %d us: %31[a-z ] %u", &us, name, &arg) != 3)
+            host_fail("%s:%u: bad line", path, nr);
+        for (p = name + strlen(name); (p > name) && (p[-1] == ' '); p--)
+            *--p = '\0';
+        if ((t += us) < 0)
+            host_fail("%s:%u: before trace start", path, nr);
+        /* Active-low inputs: DIR low steps inward, SIDE low selects head 1,
+         * and the step is logged at the rising edge of a 1us STEP pulse. */
+        if (!strcmp(name, "step")) {
+            sim_add_edge(t ? t - 1 : 0, 1, pin_dir, !arg, NO_IRQ);
+            sim_add_edge(t ? t - 1 : 0, 0, pin_step, 0, 7);
+            sim_add_edge(t, 0, pin_step, 1, 7);
+        } else if (!strcmp(name, "side")) {
+            sim_add_edge(t, 1, pin_side, !arg, 10);
+        } else if (!strcmp(name, "wgate on")) {
+            sim_add_edge(t, 1, pin_wgate, 0, 23);
+        } else if (!strcmp(name, "wgate off")) {
+            sim_add_edge(t, 1, pin_wgate, 1, 23);
+        } else if (strcmp(name, "flux") && strcmp(name, "underrun")
+                   && strcmp(name, "missed write")) {
+            host_fail("%s:%u: unknown event '%s'", path, nr, name);
+        }
+    }
+
+    fclose(f);
+}
+
+/* Copy @src, or make a pseudo-random ADF, as the image to replay against. */
+static void sim_make_image(const char *src, const char *dst)
+{
+    static uint8_t buf[901120];
+    uint32_t rnd = 1;
+    size_t n, i;
+    FILE *f;
+
+    if (src != NULL) {
+        if ((f = fopen(src, "rb")) == NULL)
+            host_fail("Cannot open %s", src);
+        n = fread(buf, 1, sizeof(buf), f);
+        if (!feof(f))
+            host_fail("%s: larger than %u bytes", src, sizeof(buf));
+        fclose(f);
+    } else {
+        for (i = 0; i < sizeof(buf); i++) {
+            rnd = rnd * 1103515245u + 12345u;
+            buf[i] = rnd >> 16;
+        }
+        n = sizeof(buf);
+    }
+
+    if (((f = fopen(dst, "wb")) == NULL) || (fwrite(buf, 1, n, f) != n))
+        host_fail("Cannot write %s", dst);
+    fclose(f);
+}
+
+static void sim_report(void)
+{
+    static const char *names[] = {
+        "step -> flux", "side -> flux", "wgate -> capture",
+        "track read", "swap -> flux"
+    };
+    unsigned int i;
+
+    printf("# Latency (us):        nr     mean      max\n");
+    for (i = 0; i < IOLAT_NR; i++) {
+        if (!sim.lat[i].nr)
+            continue;
+        printf("#  %-16s %6u %8u %8u\n", names[i], sim.lat[i].nr,
+               (uint32_t)(sim.lat[i].sum / sim.lat[i].nr), sim.lat[i].max);
+    }
+    printf("# Track loads: %u, from cache: %u\n",
+           floppy_stats.track_loads, floppy_stats.cached_loads);
+    printf("# Late starts: %u, RDATA underruns: %u, deadline misses: %u\n",
+           floppy_stats.late_starts, floppy_stats.underruns,
+           sim.deadline_misses);
+    printf("# Write bursts: %u, MFM overflows: %u, missed: %u\n",
+           floppy_stats.write_bursts, floppy_stats.write_overflows,
+           floppy_stats.missed_writes);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct v2_slot slot;
+    char dir[] = "/tmp/replayXXXXXX", path[sizeof(dir) + 16];
+    const char *trace, *src = NULL;
+    bool_t check = FALSE;
+    unsigned int i;
+    int c;
+
+    while ((c = getopt(argc, argv, "cl:")) != -1) {
+        switch (c) {
+        case 'c':
+            check = TRUE;
+            break;
+        case 'l':
+            sim.access_us = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if ((argc - optind) < 1 || (argc - optind) > 2)
+        goto usage;
+    trace = argv[optind];
+    if ((argc - optind) == 2)
+        src = argv[optind+1];
+
+    sim_load_trace(trace);
+    if (mkdtemp(dir) == NULL)
+        host_fail("mkdtemp");
+    snprintf(path, sizeof(path), "%s/image.%s", dir,
+             (src && strrchr(src, '.')) ? strrchr(src, '.') + 1 : "adf");
+    sim_make_image(src, path);
+
+    /* Bus idle and this drive selected. Inputs are active low. */
+    gpioa->idr = ~m(pin_sel0);
+    gpiob->idr = ~0u;
+
+    timers_init();
+    floppy_init();
+    if (!host_open_image(path, &slot, TRUE))
+        host_fail("Cannot open %s", path);
+    host_io = sim_io;
+    floppy_insert(0, &slot);
+
+    /* Edge times so far are microseconds from trace start. */
+    sim.t0 = sim.ev_prev = sim.now + sysclk_ms(LEAD_IN_MS);
+    for (i = 0; i < sim.nr_edges; i++)
+        sim.edges[i].time = sim.t0 + sim.edges[i].time * SYSCLK_MHZ;
+    sim.end = (sim.nr_edges ? sim.edges[sim.nr_edges-1].time : sim.t0)
+        + sysclk_ms(LEAD_OUT_MS);
+
+    while (sim.now < sim.end) {
+        if (floppy_handle())
+            host_fail("Image error");
+        sim_run(sim.now + sysclk_us(MAIN_LOOP_US));
+        sim_print_events();
+    }
+
+    sim_report();
+
+    host_close_images();
+    unlink(path);
+    rmdir(dir);
+
+    if (check) {
+        if (floppy_stats.underruns || floppy_stats.missed_writes
+            || floppy_stats.write_overflows)
+            host_fail("%s: underruns, missed writes or MFM overflows",
+                      trace);
+        if ((dma_rd->state != DMA_active)
+            || (image->cur_track != drive.cyl*2 + drive.head))
+            host_fail("%s: not streaming track %u at end", trace,
+                      drive.cyl*2 + drive.head);
+        printf("replay: %s OK\n", trace);
+    }
+
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-c] [-l <access us>] <trace> [<image>]\n",
+            argv[0]);
+    return 1;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
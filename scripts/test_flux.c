@@ -0,0 +1,458 @@
+/*
+ * test_flux.c
+ *
+ * Golden flux for the image handlers (src/image): every track of an ADF,
+ * two HFE images (DD and HD track lengths, and lengths that do not divide
+ * the revolution evenly), and direct-access mode is run through
+ * image_seek_track/image_read_track/image_rdata_flux, exactly as the read
+ * path in floppy.c drives them. One steady-state revolution of each track,
+ * index to index, is summarised as:
+ *
+ *   <image> trk <n>: <flux> flux, <ticks> ticks, crc <crc>, <bad> non-MFM
+ *
+ * and compared against scripts/flux_golden.txt. The fields are those of the
+ * on-target "audit" console command, so a golden line can be checked
+ * against a real drive too. Also checked, for each track:
+ *  - The next revolution is identical, sample for sample.
+ *  - Reads started part way round the track, consumed in batches of random
+ *    size with track reads interleaved at random, give the same flux, and
+ *    the same flux timings, as the read from the index.
+ *  - All of the above is identical with the small buffers of the Touch
+ *    build, which takes different buffering paths through the handlers.
+ *
+ * The images are generated by this test from fixed seeds, rather than
+ * checked in at 900kB apiece. After an intended change to the generated
+ * flux, rewrite the golden file with: UPDATE=1 scripts/host_test.sh flux
+ *
+ * Run by host_test.sh.
+ *
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ *
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+char *strdup(const char *s);
+
+/* The D-A status sector carries the firmware version: pin it, so that the
+ * golden flux does not change with every release. */
+#undef FW_VER
+#define FW_VER "0.0.0"
+#include "../src/image/da.c"
+
+#define GOLDEN "scripts/flux_golden.txt"
+#define MAX_LINES 512
+
+/* Enough for 3 revolutions of the longest HFE track. */
+#define MAX_FLUX (3*31000*8/2 + 16)
+
+/* Buffer sizes of the two builds (see floppy_insert). */
+static const struct {
+    const char *name;
+    unsigned int mfm_len, data_len;
+} configs[] = {
+    { "Gotek", 20*1024, 32*1024 },
+    { "Touch", 4*1024, 6*1024 }
+};
+
+/* HFE track lengths per side, in bytes, for each cylinder. */
+static const uint16_t dd_lens[] = { 12500, 12501, 12499, 12520, 6250, 12512 };
+static const uint16_t hd_lens[] = { 25000, 25007, 24992, 31000, 12500, 25001 };
+
+static uint32_t arena[(20+32)*1024/4];
+static struct image im;
+
+/* Reference stream from the index, and each sample's time past the index
+ * of the first revolution, in ticks. */
+static uint16_t ref[MAX_FLUX];
+static uint32_t ref_at[MAX_FLUX];
+static unsigned int nr_ref;
+static uint16_t tbuf[MAX_FLUX];
+
+static char *golden[MAX_LINES], *lines[MAX_LINES];
+static unsigned int nr_golden, nr_lines, nr_checked;
+
+static char dir[] = "/tmp/fluxXXXXXX";
+
+static uint32_t rnd_state;
+static uint32_t rnd(void)
+{
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return rnd_state >> 1;
+}
+
+static const char *path(const char *name)
+{
+    static char p[64];
+    snprintf(p, sizeof(p), "%s/%s", dir, name);
+    return p;
+}
+
+static void write_file(const char *name, const void *p, size_t len)
+{
+    FILE *f = fopen(path(name), "wb");
+    if ((f == NULL) || (fwrite(p, 1, len, f) != len) || fclose(f))
+        host_fail("Cannot write %s", path(name));
+}
+
+static void put_le16(uint8_t *p, uint16_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+/* MFM-encode @nr random bytes into @p, bitcells LSB first as in HFE. */
+static void hfe_mfm(uint8_t *p, unsigned int nr)
+{
+    unsigned int i, j, prev = 0;
+    uint16_t x;
+    uint8_t dat;
+
+    for (i = 0; i < nr/2; i++) {
+        dat = rnd();
+        for (j = x = 0; j < 8; j++) {
+            unsigned int d = (dat >> (7-j)) & 1;
+            x |= (!(prev | d) << (2*j)) | (d << (2*j+1));
+            prev = d;
+        }
+        p[2*i] = x;
+        p[2*i+1] = x >> 8;
+    }
+    if (nr & 1)
+        p[nr-1] = 0x55;
+}
+
+static void make_hfe(const char *name, const uint16_t *lens,
+                     unsigned int nr_cyls, uint16_t bitrate)
+{
+    unsigned int i, s, blk, off = 2, len = 2*512;
+    uint8_t *p, *side;
+
+    for (i = 0; i < nr_cyls; i++)
+        len += ((lens[i] + 255) & ~255) * 2;
+    p = calloc(1, len);
+    side = malloc(65536);
+
+    /* Disk header, then the track LUT in block 1. */
+    memset(p, 0xff, 512);
+    memcpy(p, "HXCPICFE", 8);
+    p[8] = 0; /* formatrevision */
+    p[9] = nr_cyls;
+    p[10] = 2; /* nr_sides */
+    p[11] = 0; /* ISOIBM_MFM */
+    put_le16(&p[12], bitrate);
+    put_le16(&p[14], 0); /* rpm */
+    p[16] = 7; /* GenericShugart_DD */
+    p[17] = 1;
+    put_le16(&p[18], 1); /* track_list_offset */
+
+    /* Sides interleave in 256-byte halves of each 512-byte block. */
+    for (i = 0; i < nr_cyls; i++) {
+        put_le16(&p[512 + i*4], off);
+        put_le16(&p[512 + i*4 + 2], lens[i] * 2);
+        for (s = 0; s < 2; s++) {
+            memset(side, 0, 65536);
+            hfe_mfm(side, lens[i]);
+            for (blk = 0; blk*256 < lens[i]; blk++)
+                memcpy(&p[(off + blk)*512 + s*256], &side[blk*256], 256);
+        }
+        off += (lens[i] + 255) / 256;
+    }
+
+    write_file(name, p, len);
+    free(side);
+    free(p);
+}
+
+static void make_images(void)
+{
+    unsigned int i;
+    uint8_t *p;
+
+    if (mkdtemp(dir) == NULL)
+        host_fail("Cannot create %s", dir);
+
+    p = malloc(901120);
+    rnd_state = 1;
+    for (i = 0; i < 901120; i++)
+        p[i] = rnd() >> 8;
+    write_file("test.adf", p, 901120);
+    for (i = 0; i < 8*512; i++)
+        p[i] = rnd() >> 8;
+    write_file("da.img", p, 8*512);
+    free(p);
+
+    rnd_state = 2;
+    make_hfe("dd.hfe", dd_lens, ARRAY_SIZE(dd_lens), 250);
+    rnd_state = 3;
+    make_hfe("hd.hfe", hd_lens, ARRAY_SIZE(hd_lens), 500);
+}
+
+static void remove_images(void)
+{
+    unlink(path("test.adf"));
+    unlink(path("da.img"));
+    unlink(path("dd.hfe"));
+    unlink(path("hd.hfe"));
+    rmdir(dir);
+}
+
+static void load_golden(void)
+{
+    char buf[128];
+    FILE *f;
+
+    if ((f = fopen(GOLDEN, "r")) == NULL)
+        return;
+    while ((nr_golden < MAX_LINES) && fgets(buf, sizeof(buf), f))
+        if (buf[0] != '#')
+            golden[nr_golden++] = strdup(buf);
+    fclose(f);
+}
+
+static void write_golden(void)
+{
+    unsigned int i;
+    FILE *f;
+
+    if ((f = fopen(GOLDEN, "w")) == NULL)
+        host_fail("Cannot write %s", GOLDEN);
+    fprintf(f, "# Golden flux for scripts/test_flux.c, one revolution per "
+            "track.\n# Regenerate: UPDATE=1 scripts/host_test.sh flux\n");
+    for (i = 0; i < nr_lines; i++)
+        fputs(lines[i], f);
+    fclose(f);
+}
+
+/* Record a line of output from the first buffer configuration. Later
+ * configurations must repeat it exactly. */
+static void emit(unsigned int c, const char *line)
+{
+    if (c == 0) {
+        if (nr_lines == MAX_LINES)
+            host_fail("Too many tracks");
+        lines[nr_lines++] = strdup(line);
+    } else if ((nr_checked == nr_lines) || strcmp(lines[nr_checked++], line)) {
+        host_fail("%s buffers: %s", configs[c].name, line);
+    }
+}
+
+/* Generate @nr samples, reading track data whenever flux runs dry and,
+ * if @jitter, at random points between batches of random size. */
+static void gen_flux(uint16_t *p, unsigned int nr, bool_t jitter)
+{
+    unsigned int done = 0, n, batch;
+
+    while (done < nr) {
+        if (jitter && (rnd() & 1))
+            image_read_track(&im);
+        batch = jitter ? (rnd() % 512) + 1 : 1;
+        batch = min_t(unsigned int, batch, nr - done);
+        n = image_rdata_flux(&im, &p[done], batch);
+        done += n;
+        if ((n < batch) && !image_read_track(&im) && !n)
+            host_fail("trk %u: flux stalled", im.cur_track);
+    }
+}
+
+static void seek(uint16_t track, uint32_t *start_pos)
+{
+    if (image_seek_track(&im, track, start_pos))
+        host_fail("trk %u: seek failed", track);
+}
+
+/* Read 3 revolutions from the index, a sample at a time, noting when each
+ * flux falls. cur_ticks is the time of the latest flux, and wraps at the
+ * index (it may run negative when a handler wraps ahead of the flux). */
+static void read_ref(uint16_t track)
+{
+    uint32_t start_pos = 0, base = 0, prev = 0, t, rev;
+
+    seek(track, &start_pos);
+    rev = im.tracklen_ticks;
+    if ((start_pos != 0) || (im.cur_ticks != 0))
+        host_fail("trk %u: read from index starts at %u", track, start_pos);
+
+    for (nr_ref = 0; nr_ref < MAX_FLUX; nr_ref++) {
+        gen_flux(&ref[nr_ref], 1, FALSE);
+        t = im.cur_ticks;
+        if ((int32_t)(t - prev) < 0)
+            base += rev;
+        prev = t;
+        ref_at[nr_ref] = base + t;
+        if (ref_at[nr_ref] >= 3*rev)
+            return;
+    }
+
+    host_fail("trk %u: too much flux", track);
+}
+
+/* First reference sample at or after @t ticks. */
+static unsigned int ref_idx(uint32_t t)
+{
+    unsigned int i;
+    for (i = 0; (i < nr_ref) && (ref_at[i] < t); i++)
+        continue;
+    return i;
+}
+
+/* Summarise the second revolution, and check that the third matches it. */
+static void check_revs(unsigned int c, const char *img, uint16_t track)
+{
+    uint32_t rev = im.tracklen_ticks, cell = im.ticks_per_cell;
+    uint32_t ticks = 0, bad = 0, t, n;
+    unsigned int i, i1 = ref_idx(rev), i2 = ref_idx(2*rev);
+    unsigned int i3 = ref_idx(3*rev);
+    uint16_t crc;
+    char line[128];
+
+    if (((i2 - i1) != (i3 - i2))
+        || memcmp(&ref[i1], &ref[i2], (i2 - i1) * 2))
+        host_fail("%s trk %u: revolutions differ", img, track);
+
+    for (i = i1; i < i2; i++) {
+        t = ref[i] + 1;
+        ticks += t;
+        n = ((t << 4) + cell/2) / cell;
+        if ((n < 2) || (n > 4))
+            bad++;
+    }
+    crc = crc16_ccitt(&ref[i1], (i2 - i1) * 2, 0xffff);
+
+    snprintf(line, sizeof(line),
+             "%s trk %u: %u flux, %u ticks, crc %04x, %u non-MFM\n",
+             img, im.cur_track, i2 - i1, ticks, crc, bad);
+    emit(c, line);
+}
+
+/* Start reading at a random rotational position. Once clear of the splice
+ * at the start, the flux must fall exactly where the read from the index
+ * put it. Sample timings are truncated to SYSCLK, with remainders carried:
+ * sample k is at @t0 plus 16 * (sum of sample+1 for samples 0..k), plus up
+ * to 15 ticks. */
+static void check_start(const char *img, uint16_t track)
+{
+    uint32_t start_pos, t0, splice, s = 0;
+    unsigned int i, j, k, nr, prev = ~0u;
+
+    start_pos = rnd() % (im.tracklen_ticks / 16);
+    seek(track, &start_pos);
+    t0 = im.cur_ticks;
+    if (start_pos != t0 / 16)
+        host_fail("%s trk %u: start_pos %u, at %u ticks",
+                  img, track, start_pos, t0);
+
+    /* Generate flux up to the last full reference revolution. */
+    j = ref_idx(t0 + 1);
+    nr = ref_idx(2*im.tracklen_ticks) - j;
+    gen_flux(tbuf, nr, TRUE);
+
+    splice = 64 * im.ticks_per_cell;
+    for (k = 0; k < nr; k++) {
+        s += tbuf[k] + 1;
+        if (s*16 < splice)
+            continue;
+        while ((j < nr_ref) && (((ref_at[j] - t0) >> 4) < s))
+            j++;
+        i = j;
+        if ((i == nr_ref) || (((ref_at[i] - t0) >> 4) != s)
+            || ((prev != ~0u) && (i != prev + 1)))
+            host_fail("%s trk %u: from %u ticks, flux %u at %u ticks "
+                      "is not in the read from the index",
+                      img, track, t0, k, t0 + s*16);
+        prev = i;
+    }
+}
+
+static void test_image(unsigned int c, const char *img, const uint16_t *tracks,
+                       unsigned int nr_tracks)
+{
+    struct v2_slot slot;
+    unsigned int i, j;
+
+    if (!host_open_image(path(img), &slot, FALSE) || !image_open(&im, &slot))
+        host_fail("Cannot open %s", img);
+
+    for (i = 0; i < nr_tracks; i++) {
+        read_ref(tracks[i]);
+        check_revs(c, img, tracks[i]);
+        for (j = 0; j < 3; j++)
+            check_start(img, tracks[i]);
+    }
+}
+
+static void test_config(unsigned int c)
+{
+    uint16_t tracks[160];
+    unsigned int i;
+
+    memset(&im, 0, sizeof(im));
+    im.bufs.write_mfm.p = arena;
+    im.bufs.write_mfm.len = configs[c].mfm_len;
+    im.bufs.read_mfm.len = im.bufs.write_mfm.len / 2;
+    im.bufs.read_mfm.p = (char *)arena + im.bufs.read_mfm.len;
+    im.bufs.data.p = (char *)arena + configs[c].mfm_len;
+    im.bufs.data.len = configs[c].data_len;
+    im.bufs.write_data = im.bufs.read_data = im.bufs.data;
+
+    rnd_state = 4;
+    nr_checked = 0;
+    for (i = 0; i < ARRAY_SIZE(tracks); i++)
+        tracks[i] = i;
+
+    /* Every ADF track, then direct access, and back out of it. */
+    test_image(c, "test.adf", tracks, 160);
+    host_set_disk(path("da.img"));
+    tracks[0] = 510;
+    test_image(c, "test.adf", tracks, 1);
+    if (!image_seek_track(&im, 0, NULL))
+        host_fail("Seek from direct access does not re-read config");
+    host_set_disk(NULL);
+    tracks[0] = 0;
+
+    test_image(c, "dd.hfe", tracks, ARRAY_SIZE(dd_lens)*2);
+    test_image(c, "hd.hfe", tracks, ARRAY_SIZE(hd_lens)*2);
+
+    host_close_images();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    make_images();
+    for (i = 0; i < ARRAY_SIZE(configs); i++)
+        test_config(i);
+    remove_images();
+
+    if (getenv("UPDATE")) {
+        write_golden();
+        printf("flux: wrote %u tracks to %s\n", nr_lines, GOLDEN);
+        return 0;
+    }
+
+    load_golden();
+    for (i = 0; i < max_t(unsigned int, nr_lines, nr_golden); i++) {
+        if ((i < nr_lines) && (i < nr_golden) && !strcmp(lines[i], golden[i]))
+            continue;
+        host_fail("flux differs from %s:\n  expected: %s  got:      %s",
+                  GOLDEN, (i < nr_golden) ? golden[i] : "(none)\n",
+                  (i < nr_lines) ? lines[i] : "(none)\n");
+    }
+
+    printf("flux: %u tracks match %s\n", nr_lines, GOLDEN);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
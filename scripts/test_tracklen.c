@@ -0,0 +1,136 @@
+/*
+ * test_tracklen.c
+ *
+ * Bitcell timing in src/image/image.c: muldiv() against 64-bit arithmetic,
+ * and the ticks_per_cell/ticks_rem/ticks_acc accumulator run by every
+ * handler's rdata_flux(). A full track of cells must take exactly
+ * TICKS_PER_REV, whether the track is entered at the index or part way
+ * round by image_set_cur_bc().
+ *
+ * Run by host_test.sh.
+ *
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ *
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#include <stdio.h>
+#include "../src/image/image.c"
+
+/* Track lengths, in bitcells: ADF and D-A; IBM DD, HD and ED; and HFE
+ * lengths (whole bytes) that do not divide the revolution evenly. */
+static const uint32_t tracklens[] = {
+    100160, 100000, 200000, 400000,
+    99992, 100008, 125000, 166664, 199936, 200056, 50000, 8
+};
+
+static uint32_t rnd_state = 1;
+static uint32_t rnd(void)
+{
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return rnd_state >> 1;
+}
+
+/* The rdata_flux() inner loop, cells @from to @to, starting from the state
+ * that image_set_cur_bc() left. Returns ticks at @to and the accumulator. */
+static uint32_t run_cells(const struct image *im, uint32_t from, uint32_t to,
+                          uint32_t *p_acc)
+{
+    uint32_t bc, ticks = im->cur_ticks, acc = im->ticks_acc;
+
+    for (bc = from; bc < to; bc++) {
+        ticks += im->ticks_per_cell;
+        if ((acc += im->ticks_rem) >= im->tracklen_bc) {
+            acc -= im->tracklen_bc;
+            ticks++;
+        }
+    }
+
+    *p_acc = acc;
+    return ticks;
+}
+
+static void test_muldiv(void)
+{
+    uint32_t a, b, d, q, r;
+    uint64_t x;
+    unsigned int i;
+
+    for (i = 0; i < 1000000; i++) {
+        d = (rnd() % 0x7fffffffu) + 1;
+        b = rnd() % d;
+        a = (i & 1) ? rnd() << 1 : rnd() % (d + 1);
+        x = (uint64_t)a * b;
+        if (x / d > 0xffffffffu)
+            continue;
+        q = muldiv(a, b, d, &r);
+        if ((q != x / d) || (r != x % d))
+            host_fail("muldiv(%u,%u,%u) = %u rem %u", a, b, d, q, r);
+    }
+}
+
+static void test_tracklen(uint32_t tracklen_bc)
+{
+    static struct image im;
+    uint32_t bc, ticks, acc, ref_ticks, ref_acc;
+    unsigned int i;
+
+    memset(&im, 0, sizeof(im));
+    image_set_tracklen_bc(&im, tracklen_bc);
+    if ((im.tracklen_ticks != TICKS_PER_REV) || im.cur_bc || im.cur_ticks
+        || im.ticks_acc)
+        host_fail("%u: bad state at index", tracklen_bc);
+
+    /* From the index, round to the index. */
+    ticks = run_cells(&im, 0, tracklen_bc, &acc);
+    if ((ticks != TICKS_PER_REV) || acc)
+        host_fail("%u: revolution is %u ticks (acc %u), not %u",
+                  tracklen_bc, ticks, acc, TICKS_PER_REV);
+
+    /* From part way round: image_set_cur_bc() must agree with running the
+     * cells from the index, and the rest of the track must make up the
+     * revolution exactly. Cover the ends, the ADF and HFE seek
+     * granularities, and random cells. */
+    for (i = 0; i < 150; i++) {
+        bc = (i < 2) ? i * (tracklen_bc - 1)
+            : (i < 50) ? ((rnd() % tracklen_bc) & ~511)
+            : (i < 100) ? ((rnd() % tracklen_bc) & ~7)
+            : (rnd() % tracklen_bc);
+        image_set_tracklen_bc(&im, tracklen_bc);
+        ref_ticks = run_cells(&im, 0, bc, &ref_acc);
+        image_set_cur_bc(&im, bc);
+        if ((im.cur_ticks != ref_ticks) || (im.ticks_acc != ref_acc))
+            host_fail("%u: at cell %u, %u ticks acc %u, expected %u acc %u",
+                      tracklen_bc, bc, im.cur_ticks, im.ticks_acc,
+                      ref_ticks, ref_acc);
+        ticks = run_cells(&im, bc, tracklen_bc, &acc);
+        if ((ticks != TICKS_PER_REV) || acc)
+            host_fail("%u: from cell %u, revolution is %u ticks, not %u",
+                      tracklen_bc, bc, ticks, TICKS_PER_REV);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    test_muldiv();
+    for (i = 0; i < ARRAY_SIZE(tracklens); i++)
+        test_tracklen(tracklens[i]);
+    for (i = 0; i < 20; i++)
+        test_tracklen(((rnd() % 400000) + 8) & ~7);
+
+    printf("tracklen: revolutions exactly %u ticks\n", TICKS_PER_REV);
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,171 @@
+/*
+ * capture.c
+ * 
+ * Raw flux capture of host writes to an SCP-style file.
+ * 
+ * Each write burst is stored as an SCP track, with one revolution entry per
+ * index-delimited segment of the burst. A new capture session overwrites the
+ * file from the start but never shrinks it: a large pre-allocated file 
+ * avoids cluster allocation while a capture is streaming. The header 
+ * checksum is not maintained (always zero).
+ * 
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ * 
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#define SCP_MAX_TRACKS 168
+
+struct scp_header {
+    char sig[3];
+    uint8_t version;
+    uint8_t disk_type;
+    uint8_t nr_revs;
+    uint8_t start_trk, end_trk;
+    uint8_t flags;
+    uint8_t cell_width; /* 0 = 16 bits */
+    uint8_t heads; /* 0 = both */
+    uint8_t resolution; /* 0 = 25ns */
+    uint32_t csum;
+};
+
+#define SCP_TRK_OFF(trk) (sizeof(struct scp_header) + (trk)*4)
+
+struct scp_tdh {
+    char sig[3];
+    uint8_t track;
+    struct {
+        uint32_t duration, nr_flux, offset;
+    } rev[CAPTURE_MAX_REVS];
+};
+
+struct capture {
+    FIL fp;
+    struct scp_header hdr;
+    uint32_t tdh; /* file offset of the current track data header */
+    uint16_t track;
+    bool_t active; /* between capture_begin() and capture_end() */
+};
+
+struct capture *capture_open(void)
+{
+    struct capture *cap;
+    uint32_t zero[8];
+    unsigned int i;
+
+    /* Cheap check first, so that we allocate nothing if not capturing. */
+    if (f_stat(CAPTURE_FILE, NULL) != FR_OK)
+        return NULL;
+
+    /* Open into the arena's free space, and claim it only on success: a 
+     * read-only file must not cost the image buffers anything. */
+    if (arena_avail() < sizeof(*cap))
+        return NULL;
+    cap = arena_alloc(0);
+    if (f_open(&cap->fp, CAPTURE_FILE, FA_READ | FA_WRITE) != FR_OK) {
+        printk("Capture: cannot open %s for writing\n", CAPTURE_FILE);
+        return NULL;
+    }
+    (void)arena_alloc(sizeof(*cap));
+    cap->active = FALSE;
+
+    memset(&cap->hdr, 0, sizeof(cap->hdr));
+    memcpy(cap->hdr.sig, "SCP", 3);
+    cap->hdr.disk_type = 0x80; /* other */
+    cap->hdr.nr_revs = CAPTURE_MAX_REVS;
+    cap->hdr.start_trk = SCP_MAX_TRACKS-1;
+    F_write(&cap->fp, &cap->hdr, sizeof(cap->hdr), NULL);
+
+    /* Empty track table. */
+    memset(zero, 0, sizeof(zero));
+    for (i = 0; i < SCP_MAX_TRACKS*4; i += sizeof(zero))
+        F_write(&cap->fp, zero,
+                min_t(unsigned int, sizeof(zero), SCP_MAX_TRACKS*4 - i),
+                NULL);
+    F_sync(&cap->fp);
+
+    printk("Capture: writes go to %s (%u bytes pre-allocated)\n",
+           CAPTURE_FILE, f_size(&cap->fp));
+    return cap;
+}
+
+void capture_begin(struct capture *cap, uint16_t track)
+{
+    struct scp_tdh tdh;
+
+    /* Place the header so that flux data is sector aligned: FatFS then 
+     * writes whole sectors straight from our buffer. */
+    cap->tdh = ((f_tell(&cap->fp) + sizeof(tdh) + 511) & ~511) - sizeof(tdh);
+    cap->track = track;
+    cap->active = TRUE;
+
+    /* Placeholder header, filled in by capture_end(). */
+    memset(&tdh, 0, sizeof(tdh));
+    F_lseek(&cap->fp, cap->tdh);
+    F_write(&cap->fp, &tdh, sizeof(tdh), NULL);
+}
+
+void capture_write(struct capture *cap, const void *p, uint32_t len)
+{
+    F_write(&cap->fp, p, len, NULL);
+}
+
+void capture_end(struct capture *cap,
+                 const struct capture_rev *rev, unsigned int nr_revs)
+{
+    struct scp_tdh tdh;
+    uint32_t end = f_tell(&cap->fp), off = sizeof(tdh);
+    unsigned int i;
+
+    memcpy(tdh.sig, "TRK", 3);
+    tdh.track = cap->track;
+    for (i = 0; i < CAPTURE_MAX_REVS; i++) {
+        tdh.rev[i].duration = (i < nr_revs) ? rev[i].duration : 0;
+        tdh.rev[i].nr_flux = (i < nr_revs) ? rev[i].nr_flux : 0;
+        tdh.rev[i].offset = off;
+        off += tdh.rev[i].nr_flux * 2;
+    }
+    F_lseek(&cap->fp, cap->tdh);
+    F_write(&cap->fp, &tdh, sizeof(tdh), NULL);
+
+    if (cap->track < SCP_MAX_TRACKS) {
+        /* Latest capture of a track wins the track-table entry. */
+        F_lseek(&cap->fp, SCP_TRK_OFF(cap->track));
+        F_write(&cap->fp, &cap->tdh, 4, NULL);
+        cap->hdr.start_trk = min_t(uint8_t, cap->hdr.start_trk, cap->track);
+        cap->hdr.end_trk = max_t(uint8_t, cap->hdr.end_trk, cap->track);
+        F_lseek(&cap->fp, 0);
+        F_write(&cap->fp, &cap->hdr, sizeof(cap->hdr), NULL);
+    }
+
+    F_lseek(&cap->fp, end);
+    F_sync(&cap->fp);
+    cap->active = FALSE;
+
+    trace(TRACE_DEFAULT, "Capture trk %u: %u revs, %u bytes\n",
+          cap->track, nr_revs, end - cap->tdh);
+}
+
+void capture_abort(struct capture *cap)
+{
+    if (!cap->active)
+        return;
+
+    /* The burst's placeholder header is not in the track table, so the next 
+     * burst may simply overwrite it and whatever flux follows. */
+    F_lseek(&cap->fp, cap->tdh);
+    cap->active = FALSE;
+
+    trace(TRACE_DEFAULT, "Capture trk %u: aborted\n", cap->track);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -1,7 +1,8 @@
 /*
  * console.c
  * 
- * printf-style interface to USART1.
+ * printf-style interface to USART1, and a simple command line.
+ * Release builds keep only the command line.
  * 
  * Written & released by Keir Fraser <keir.xen@gmail.com>
  * 
@@ -12,6 +13,42 @@
 #define BAUD 3000000 /* 3Mbaud */
 
 #define USART1_IRQ 37
+void IRQ_37(void) __attribute__((alias("IRQ_console_rx")));
+
+#ifndef NDEBUG
+
+/* Soft IRQ with no handler: pending it yields a crash dump of whatever 
+ * context the console IRQ interrupted. */
+#define CRASH_IRQ 44
+
+#define CTRL_C 0x03
+
+uint8_t trace_level = TRACE_DEFAULT;
+static bool_t crash_on_input;
+
+#else /* NDEBUG */
+
+/* Release builds keep the command line but not the diagnostic stream: only 
+ * console_process() produces output, so stray printk()s cost a call. */
+static bool_t console_active;
+
+#endif
+
+/* Received characters, produced by IRQ_console_rx(), consumed by 
+ * console_process(). */
+static struct {
+    char buf[32];
+    volatile uint8_t prod;
+    uint8_t cons;
+} rxq;
+#define RXQ_MASK(x) ((x)&(sizeof(rxq.buf)-1))
+
+/* Command line under construction. */
+static char cmdline[40];
+static uint8_t cmdlen;
+
+static const struct console_cmd *app_cmds;
+static unsigned int nr_app_cmds;
 
 static void emit_char(uint8_t c)
 {
@@ -26,6 +63,11 @@ int vprintk(const char *format, va_list ap)
     char *p, c;
     int n;
 
+#ifdef NDEBUG
+    if (!console_active)
+        return 0;
+#endif
+
     IRQ_global_disable();
 
     n = vsnprintf(str, sizeof(str), format, ap);
@@ -61,11 +103,13 @@ int printk(const char *format, ...)
     return n;
 }
 
+#ifndef NDEBUG
 void console_sync(void)
 {
     IRQ_global_disable();
     /* Leave IRQs globally disabled. */
 }
+#endif
 
 void console_init(void)
 {
@@ -82,16 +126,186 @@ void console_init(void)
     usart1->cr3 = 0;
 }
 
-/* Debug helper: if we get stuck somewhere, calling this beforehand will cause 
- * any serial input to cause a crash dump of the stuck context. */
-void console_crash_on_input(void)
+static void rx_enable(void)
 {
     (void)usart1->dr; /* clear UART_SR_RXNE */
     usart1->cr1 |= USART_CR1_RXNEIE;
+#ifndef NDEBUG
+    /* The handler is only a few instructions, so run it at top priority: 
+     * Ctrl-C must be able to interrupt a stuck context of any priority. */
     IRQx_set_prio(USART1_IRQ, RESET_IRQ_PRI);
+    IRQx_set_prio(CRASH_IRQ, RESET_IRQ_PRI);
+    IRQx_enable(CRASH_IRQ);
+#else
+    /* Release builds only queue command-line input for the main loop: 
+     * stay out of the way of the floppy interface. */
+    IRQx_set_prio(USART1_IRQ, CONSOLE_IRQ_PRI);
+#endif
     IRQx_enable(USART1_IRQ);
 }
 
+static void IRQ_console_rx(void)
+{
+    uint8_t c;
+
+    (void)usart1->sr; /* SR then DR read clears any overrun */
+    c = usart1->dr;
+
+#ifndef NDEBUG
+    if (crash_on_input || (c == CTRL_C)) {
+        /* Tail-chains as soon as we return, so the dump shows the context 
+         * we interrupted rather than this handler. */
+        IRQx_set_pending(CRASH_IRQ);
+        return;
+    }
+#endif
+
+    if ((uint8_t)(rxq.prod - rxq.cons) < sizeof(rxq.buf)) {
+        rxq.buf[RXQ_MASK(rxq.prod)] = c;
+        barrier(); /* write character /then/ publish it */
+        rxq.prod++;
+    }
+}
+
+#ifndef NDEBUG
+/* Debug helper: if we get stuck somewhere, calling this beforehand will cause 
+ * any serial input to cause a crash dump of the stuck context. */
+void console_crash_on_input(void)
+{
+    crash_on_input = TRUE;
+    rx_enable();
+}
+#endif
+
+void console_set_cmds(const struct console_cmd *cmds, unsigned int nr)
+{
+    app_cmds = cmds;
+    nr_app_cmds = nr;
+    rx_enable();
+}
+
+static void cmd_help(int argc, char *argv[]);
+#ifndef NDEBUG
+static void cmd_trace(int argc, char *argv[]);
+#endif
+
+static const struct console_cmd builtin_cmds[] = {
+    { "help", "List commands", cmd_help },
+#ifndef NDEBUG
+    { "trace", "Get/set diagnostic verbosity [0-2]", cmd_trace }
+#endif
+};
+
+static void list_cmds(const struct console_cmd *cmds, unsigned int nr)
+{
+    unsigned int i;
+    for (i = 0; i < nr; i++)
+        printk(" %s: %s\n", cmds[i].name, cmds[i].help);
+}
+
+static void cmd_help(int argc, char *argv[])
+{
+    list_cmds(builtin_cmds, ARRAY_SIZE(builtin_cmds));
+    list_cmds(app_cmds, nr_app_cmds);
+#ifndef NDEBUG
+    printk(" Ctrl-C: Crash dump\n");
+#endif
+}
+
+#ifndef NDEBUG
+static void cmd_trace(int argc, char *argv[])
+{
+    char c = (argc > 1) ? argv[1][0] : '\0';
+
+    if ((c >= '0') && (c <= '0' + TRACE_VERBOSE) && !argv[1][1])
+        trace_level = c - '0';
+    else if (argc > 1)
+        printk("Bad trace level '%s'\n", argv[1]);
+    printk("Trace level %u\n", trace_level);
+}
+#endif
+
+static const struct console_cmd *find_cmd(
+    const struct console_cmd *cmds, unsigned int nr, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < nr; i++)
+        if (!strcmp(cmds[i].name, name))
+            return &cmds[i];
+    return NULL;
+}
+
+static void run_cmdline(void)
+{
+    const struct console_cmd *cmd;
+    char *argv[4], *p = cmdline;
+    int argc = 0;
+
+    /* Split into space-separated words, in place. */
+    cmdline[cmdlen] = '\0';
+    while (argc < ARRAY_SIZE(argv)) {
+        while (*p == ' ')
+            *p++ = '\0';
+        if (*p == '\0')
+            break;
+        argv[argc++] = p;
+        while ((*p != ' ') && (*p != '\0'))
+            p++;
+    }
+
+    if (argc == 0)
+        return;
+
+    cmd = find_cmd(builtin_cmds, ARRAY_SIZE(builtin_cmds), argv[0]);
+    if (cmd == NULL)
+        cmd = find_cmd(app_cmds, nr_app_cmds, argv[0]);
+    if (cmd == NULL)
+        printk("Unknown command '%s': try 'help'\n", argv[0]);
+    else
+        (*cmd->fn)(argc, argv);
+}
+
+void console_process(void)
+{
+    uint8_t prod = rxq.prod;
+    char c;
+
+    barrier(); /* take producer index /then/ read characters */
+
+#ifdef NDEBUG
+    if (rxq.cons == prod)
+        return;
+    console_active = TRUE;
+#endif
+
+    while (rxq.cons != prod) {
+        c = rxq.buf[RXQ_MASK(rxq.cons++)];
+        switch (c) {
+        case '\r': case '\n':
+            printk("\n");
+            run_cmdline();
+            cmdlen = 0;
+            break;
+        case '\b': case 0x7f: /* backspace, delete */
+            if (cmdlen) {
+                cmdlen--;
+                printk("\b \b");
+            }
+            break;
+        default:
+            if ((c >= ' ') && (c <= '~') && (cmdlen < sizeof(cmdline)-1)) {
+                cmdline[cmdlen++] = c;
+                printk("%c", c);
+            }
+            break;
+        }
+    }
+
+#ifdef NDEBUG
+    console_active = FALSE;
+#endif
+}
+
 /*
  * Local variables:
  * mode: C
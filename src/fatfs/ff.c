@@ -3645,6 +3645,101 @@ FRESULT f_read (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Read File into a Scatter-Gather List                                  */
+/*-----------------------------------------------------------------------*/
+
+#if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2
+static void sg_copy (	/* Copy data into a segment list at a byte offset */
+	const DSEG* seg,	/* Segment list */
+	UINT ofs,			/* Byte offset into the segment list */
+	const BYTE* src,	/* Source data */
+	UINT cnt			/* Number of bytes to copy */
+)
+{
+	UINT n;
+
+
+	for ( ; ofs >= seg->len; seg++) ofs -= seg->len;	/* Find the first segment */
+	for ( ; cnt; cnt -= n, src += n, seg++, ofs = 0) {
+		n = seg->len - ofs;
+		if (n > cnt) n = cnt;
+		if (seg->buff) mem_cpy(seg->buff + ofs, src, n);
+	}
+}
+#endif
+
+FRESULT f_read_sg (
+	FIL* fp, 		/* Pointer to the file object */
+	const DSEG* seg,	/* Pointer to the segment list */
+	UINT nseg,		/* Number of segments */
+	UINT* br		/* Pointer to number of bytes read */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, sect;
+	FSIZE_t remain;
+	UINT btr, rcnt, cc, csect, i;
+
+
+	*br = 0;	/* Clear read byte counter */
+	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+	for (btr = i = 0; i < nseg; i++) btr += seg[i].len;	/* Total bytes to read */
+	if (fp->fptr % SS(fs) || btr % SS(fs)) LEAVE_FF(fs, FR_INVALID_PARAMETER);	/* Whole sectors only */
+	remain = fp->obj.objsize - fp->fptr;
+	if (btr > remain) btr = (UINT)remain / SS(fs) * SS(fs);	/* Truncate btr by remaining whole sectors */
+
+	for ( ;  btr;								/* Repeat until all data read */
+		btr -= rcnt, *br += rcnt, fp->fptr += rcnt) {
+		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
+		if (csect == 0) {					/* On the cluster boundary? */
+			if (fp->fptr == 0) {			/* On the top of the file? */
+				clst = fp->obj.sclust;		/* Follow cluster chain from the origin */
+			} else {						/* Middle or end of the file */
+#if FF_USE_FASTSEEK
+				if (fp->cltbl) {
+					clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+				} else
+#endif
+				{
+					clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+				}
+			}
+			if (clst < 2) ABORT(fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+			fp->clust = clst;				/* Update current cluster */
+		}
+		sect = clst2sect(fs, fp->clust);	/* Get current sector */
+		if (sect == 0) ABORT(fs, FR_INT_ERR);
+		sect += csect;
+		cc = btr / SS(fs);					/* Read maximum contiguous sectors directly */
+		if (csect + cc > fs->csize) {		/* Clip at cluster boundary */
+			cc = fs->csize - csect;
+		}
+		if (disk_read_sg(fs->pdrv, seg, *br, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
+#if FF_FS_TINY
+		if (fs->wflag && fs->winsect - sect < cc) {
+			sg_copy(seg, *br + (fs->winsect - sect) * SS(fs), fs->win, SS(fs));
+		}
+#else
+		if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
+			sg_copy(seg, *br + (fp->sect - sect) * SS(fs), fp->buf, SS(fs));
+		}
+#endif
+#endif
+		rcnt = SS(fs) * cc;					/* Number of bytes transferred */
+	}
+
+	LEAVE_FF(fs, FR_OK);
+}
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Write File                                                            */
@@ -4382,6 +4477,35 @@ FRESULT f_findfirst (
 	return res;
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Find First File from a Directory Offset                               */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_findfrom (
+	DIR* dp,				/* Pointer to the blank directory object */
+	FILINFO* fno,			/* Pointer to the file information structure */
+	const TCHAR* path,		/* Pointer to the directory to open */
+	const TCHAR* pattern,	/* Pointer to the matching pattern */
+	DWORD ofs				/* Offset to search from (a dp->dptr value) */
+)
+{
+	FRESULT res;
+
+
+	dp->pat = pattern;		/* Save pointer to pattern string */
+	res = f_opendir(dp, path);		/* Open the target directory */
+	if (res == FR_OK) {
+		res = dir_sdi(dp, ofs);		/* Move to the offset */
+		if (res == FR_OK) {
+			res = f_findnext(dp, fno);	/* Find the first item from there */
+		}
+	}
+	return res;
+}
+
 #endif	/* FF_USE_FIND */
 
 
@@ -173,6 +173,15 @@ typedef struct {
 
 
 
+/* Scatter-gather read segment (DSEG) */
+
+typedef struct {
+	BYTE*	buff;			/* Destination buffer (NULL: discard the data) */
+	UINT	len;			/* Length in bytes (multiple of 64) */
+} DSEG;
+
+
+
 /* Directory object structure (DIR) */
 
 typedef struct {
@@ -243,6 +252,7 @@ typedef enum {
 FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode);				/* Open or create a file */
 FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);			/* Read data from the file */
+FRESULT f_read_sg (FIL* fp, const DSEG* seg, UINT nseg, UINT* br);	/* Read whole sectors from the file into a segment list */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to the file */
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
@@ -251,6 +261,7 @@ FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);	/* Find first file */
+FRESULT f_findfrom (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern, DWORD ofs);	/* Find first file from a directory offset */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);							/* Find next file */
 FRESULT f_mkdir (const TCHAR* path);								/* Create a sub directory */
 FRESULT f_unlink (const TCHAR* path);								/* Delete an existing file or directory */
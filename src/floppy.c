@@ -15,6 +15,36 @@
 
 #define m(pin) (1u<<(pin))
 
+/* Steps closer together than this, in the same direction, are treated as
+ * a burst: we defer track I/O until the burst appears to be over. */
+#define STEP_BURST_MS 30
+
+/* After this long deselected, the read stream is suspended until we are 
+ * selected again. */
+#define DESEL_SUSPEND_MS 50
+
+/* Dedicated size of the write MFM ring. During a write burst the ring is
+ * extended into idle read-data memory, up to the handler's staging area. */
+#if BUILD_TOUCH
+/* Small-RAM profile (20kB). 4kB absorbs 65ms of write latency at DD rate, 
+ * and the DMA rings refill twice as often. */
+#define WRITE_MFM_LEN (4*1024)
+#define DMA_RING_LEN  512
+#else
+#define WRITE_MFM_LEN (20*1024)
+#define DMA_RING_LEN  1024
+#endif
+
+/* Smallest data area that holds an ADF track (also sufficient for 
+ * direct-access mode). HFE tracks that do not fit are written a block 
+ * at a time. */
+#define DATA_MIN_LEN  (11*512)
+
+/* Least arena that holds the floppy buffers: the write MFM ring, both DMA 
+ * rings, the image, and the smallest data area. */
+#define FLOPPY_ARENA_MIN (WRITE_MFM_LEN + 2*sizeof(struct dma_ring)   \
+                          + sizeof(struct image) + DATA_MIN_LEN)
+
 /* A soft IRQ for handling step pulses. */
 static void drive_step_timer(void *_drv);
 void IRQ_43(void) __attribute__((alias("IRQ_step")));
@@ -46,7 +76,7 @@ struct dma_ring {
         uint16_t prev_sample; /* dma_wr: previous CCRx sample value */
     };
     /* DMA ring buffer of timer values (ARR or CCRx). */
-    uint16_t buf[1024];
+    uint16_t buf[DMA_RING_LEN];
 };
 
 /* DMA buffers are permanently allocated while a disk image is loaded, allowing 
@@ -72,22 +102,269 @@ static struct drive {
         bool_t inward;
         stk_time_t start;
         struct timer timer;
+        /* Step-burst prediction, maintained by lo-irq. */
+        bool_t prev_inward;
+        stk_time_t prev_start;
+        uint32_t burst; /* != 0: interval between steps of current burst */
     } step;
+    /* Deselection tracking, maintained by main loop. */
+    bool_t desel, suspended;
+    stk_time_t desel_start;
     struct image *image;
 } drive;
 
 static struct image *image;
 static stk_time_t sync_time;
 
+/* Image swap in progress: timed from reinsertion, once the new slot is 
+ * chosen and committed, to the new image's first flux. The user's time at 
+ * the buttons is not swap latency. Logged and cleared at first flux. */
+static struct {
+    bool_t active;
+    stk32_time_t start;
+    uint32_t open_us; /* reinsertion to new image open */
+} swap;
+
 static struct {
     struct timer timer;
     bool_t active;
+    /* Set when the flux stream may have slipped against the index timer. */
+    bool_t resync;
     stk_time_t prev_time;
 } index;
 static void index_pulse(void *);
 
 static uint32_t max_read_us;
 
+/* Write MFM ring usage during the current write burst. */
+static struct {
+    uint32_t peak; /* maximum buffered MFM, bytes */
+    uint32_t overflows; /* words (capture: samples) dropped, ring full */
+} write_mfm_stats;
+
+/* Running totals since the image was inserted, for the console. */
+static struct {
+    uint32_t track_loads, cached_loads;
+    uint32_t late_starts, underruns;
+    uint32_t write_bursts, write_overflows, missed_writes;
+} floppy_stats;
+
+/* Host-visible latency being timed for iostats: from the last step or side 
+ * change to the read stream starting, and from WGATE to the write path 
+ * accepting flux. Timed on the non-wrapping clock, as a host may wait for 
+ * seconds. The rd_start/rd_type pair is updated and consumed atomically. */
+#define LAT_none 0xff
+static struct {
+    stk32_time_t rd_start, wr_start;
+    uint8_t rd_type; /* IOLAT_step_flux, IOLAT_side_flux, or LAT_none */
+} lat = { .rd_type = LAT_none };
+
+/* Time from recent STK time @start until the read stream restarts. 
+ * May be called from any IRQ up to and including WGATE priority. */
+static void lat_read_from(uint8_t type, stk_time_t start)
+{
+    stk32_time_t start32 = stk32_now() - stk_timesince(start);
+    uint32_t oldpri = IRQ_save(FLOPPY_IRQ_WGATE_PRI);
+    lat.rd_start = start32;
+    lat.rd_type = type;
+    IRQ_restore(oldpri);
+}
+
+/* Flux capture: if CAPTURE.SCP exists, write bursts are streamed to it as 
+ * raw flux, via the write_mfm ring, instead of being decoded to the image. */
+static struct {
+    struct capture *cap;
+    uint32_t acc; /* remainder of SYSCLK-tick to 25ns conversion */
+    /* Index pulse during a write, as a position in the WDATA DMA ring. 
+     * Set by index_pulse(), consumed by IRQ_wdata_dma(). */
+    volatile bool_t index;
+    uint16_t index_pos;
+    uint8_t nr_revs;
+    struct capture_rev rev[CAPTURE_MAX_REVS];
+} capture;
+
+/* Host bus events and stream responses. */
+#define EV_step      0 /* arg: 1 = inward */
+#define EV_side      1 /* arg: new head */
+#define EV_wgate_on  2 /* arg: track */
+#define EV_wgate_off 3
+#define EV_flux      4 /* arg: track; read stream started */
+#define EV_underrun  5
+#define EV_missed_wr 6
+
+#ifndef NDEBUG
+
+/* Flux audit (console "audit" command). Checks the generated read stream 
+ * one revolution at a time, index to index: a signature to compare across 
+ * builds, total revolution time, bitcell intervals outside the MFM 2/3/4 
+ * cell windows, and time spent generating the flux. */
+static struct {
+    bool_t on;
+    bool_t started; /* seen an index crossing since the stream started */
+    uint16_t crc;
+    uint32_t nr_flux, ticks, bad, cost;
+    /* Completed revolution, printed by the main loop. */
+    volatile bool_t ready;
+    struct {
+        uint16_t track, crc;
+        uint32_t nr_flux, ticks, bad, cost;
+    } rev;
+} audit;
+
+static void audit_samples(struct image *im, const uint16_t *tbuf,
+                          unsigned int nr)
+{
+    uint32_t cell = im->ticks_per_cell, t, n;
+    unsigned int i;
+
+    for (i = 0; i < nr; i++) {
+        t = tbuf[i] + 1;
+        audit.ticks += t;
+        n = ((t << 4) + cell/2) / cell;
+        if ((n < 2) || (n > 4))
+            audit.bad++;
+    }
+    audit.nr_flux += nr;
+    audit.crc = crc16_ccitt(tbuf, nr*2, audit.crc);
+}
+
+/* Audit @nr new samples at @tbuf, generated in @cost systicks. */
+static void flux_audit(struct image *im, const uint16_t *tbuf,
+                       unsigned int nr, uint32_t cost)
+{
+    uint32_t pos, t;
+    int i;
+
+    if (!audit.on)
+        return;
+
+    /* The last sample ends image_ticks_since_index() past the index. Walk 
+     * back to find the first sample of a new revolution, if any. */
+    pos = image_ticks_since_index(im);
+    for (i = nr-1; i >= 0; i--) {
+        t = tbuf[i] + 1;
+        if (t >= pos)
+            break;
+        pos -= t;
+    }
+
+    audit.cost += cost;
+    if (i < 0) {
+        if (audit.started)
+            audit_samples(im, tbuf, nr);
+        return;
+    }
+
+    if (audit.started) {
+        audit_samples(im, tbuf, i);
+        if (!audit.ready) {
+            audit.rev.track = im->cur_track;
+            audit.rev.crc = audit.crc;
+            audit.rev.nr_flux = audit.nr_flux;
+            audit.rev.ticks = audit.ticks;
+            audit.rev.bad = audit.bad;
+            audit.rev.cost = audit.cost;
+            barrier(); /* fill in results /then/ flag them */
+            audit.ready = TRUE;
+        }
+    }
+
+    audit.started = TRUE;
+    audit.crc = 0xffff;
+    audit.nr_flux = audit.ticks = audit.bad = audit.cost = 0;
+    audit_samples(im, &tbuf[i], nr-i);
+}
+
+static void audit_report(void)
+{
+    if (!audit.ready)
+        return;
+    printk("Audit trk %u: %u flux, %u ticks, crc %04x, %u non-MFM, %u us\n",
+           audit.rev.track, audit.rev.nr_flux, audit.rev.ticks,
+           audit.rev.crc, audit.rev.bad, audit.rev.cost / STK_MHZ);
+    audit.ready = FALSE;
+}
+
+static void audit_restart(void)
+{
+    audit.started = FALSE;
+}
+
+void floppy_set_audit(bool_t on)
+{
+    audit_restart();
+    audit.ready = FALSE;
+    audit.on = on;
+}
+
+bool_t floppy_get_audit(void)
+{
+    return audit.on;
+}
+
+/* Host bus events (console "events" command): a timestamped record of a 
+ * host's access pattern and the stream responses, for offline replay. */
+static struct {
+    struct bus_event {
+        stk_time_t time;
+        uint8_t type;
+        uint16_t arg;
+    } ev[32];
+    uint32_t prod;
+} events;
+
+/* May be called from any IRQ up to and including WGATE priority. */
+static void bus_event(uint8_t type, uint16_t arg, stk_time_t time)
+{
+    struct bus_event *ev;
+    uint32_t oldpri = IRQ_save(FLOPPY_IRQ_WGATE_PRI);
+    ev = &events.ev[events.prod++ & (ARRAY_SIZE(events.ev)-1)];
+    ev->time = time;
+    ev->type = type;
+    ev->arg = arg;
+    IRQ_restore(oldpri);
+}
+
+void floppy_dump_events(void)
+{
+    static const char *names[] = {
+        "step", "side", "wgate on", "wgate off",
+        "flux", "underrun", "missed write"
+    };
+    struct bus_event ev[ARRAY_SIZE(events.ev)];
+    stk_time_t prev;
+    uint32_t i, prod, oldpri;
+
+    /* Snapshot the log so that printing does not race new events. */
+    oldpri = IRQ_save(FLOPPY_IRQ_WGATE_PRI);
+    memcpy(ev, events.ev, sizeof(ev));
+    prod = events.prod;
+    IRQ_restore(oldpri);
+
+    /* Oldest first, with microseconds since the previous event. SysTick 
+     * wraps every couple of seconds, so longer gaps are not shown 
+     * correctly. Events logged from different IRQs may be slightly out of 
+     * order, hence the signed delta. */
+    i = (prod > ARRAY_SIZE(ev)) ? prod - ARRAY_SIZE(ev) : 0;
+    prev = ev[i & (ARRAY_SIZE(ev)-1)].time;
+    for (; i != prod; i++) {
+        struct bus_event *e = &ev[i & (ARRAY_SIZE(ev)-1)];
+        printk("%d us: %s %u\n", stk_delta(prev, e->time) / STK_MHZ,
+               names[e->type], e->arg);
+        prev = e->time;
+    }
+}
+
+#else /* NDEBUG */
+
+static inline void bus_event(uint8_t type, uint16_t arg, stk_time_t time) {}
+static inline void flux_audit(struct image *im, const uint16_t *tbuf,
+                              unsigned int nr, uint32_t cost) {}
+static inline void audit_report(void) {}
+static inline void audit_restart(void) {}
+
+#endif
+
 static void rdata_stop(void);
 static void wdata_start(void);
 static void wdata_stop(void);
@@ -133,7 +410,11 @@ void floppy_cancel(void)
     /* Clear soft state. */
     drive.image = NULL;
     drive.slot = NULL;
+    swap.active = FALSE;
     max_read_us = 0;
+    memset(&floppy_stats, 0, sizeof(floppy_stats));
+    lat.rd_type = LAT_none;
+    capture.cap = NULL;
     image = NULL;
     dma_rd = dma_wr = NULL;
 
@@ -199,6 +480,10 @@ void floppy_init(void)
 
 void floppy_insert(unsigned int unit, struct v2_slot *slot)
 {
+    /* Static data is sized only at link time: the ASSERT below checks the 
+     * data area actually left over. */
+    BUILD_BUG_ON(FLOPPY_ARENA_MIN > ARENA_MAX_LEN);
+
     arena_init();
 
     dma_rd = dma_ring_alloc();
@@ -207,15 +492,29 @@ void floppy_insert(unsigned int unit, struct v2_slot *slot)
     image = arena_alloc(sizeof(*image));
     memset(image, 0, sizeof(*image));
 
+#if !BUILD_TOUCH
+    /* Flux capture streams through the write_mfm ring, which on the 
+     * small-RAM build is far too small to ride out mass-storage latency. 
+     * Its state must sit below the ring: writes extend the ring upwards. */
+    capture.cap = capture_open();
+#endif
+
     /* Large buffer to absorb long write latencies at mass-storage layer. */
-    image->bufs.write_mfm.len = 20*1024;
+    image->bufs.write_mfm.len = WRITE_MFM_LEN;
     image->bufs.write_mfm.p = arena_alloc(image->bufs.write_mfm.len);
 
     /* Any remaining space is used for staging writes to mass storage, for 
      * example when format conversion is required and it is not possible to 
-     * do this in place within the write_mfm buffer. */
-    image->bufs.write_data.len = arena_avail();
-    image->bufs.write_data.p = arena_alloc(image->bufs.write_data.len);
+     * do this in place within the write_mfm buffer. The image handler sizes
+     * the staging area when the image is opened. It sits at the top of this
+     * space: the rest is used only for read data, and so is lent to the 
+     * write_mfm buffer (which immediately precedes it) during writes. */
+    image->bufs.data.len = arena_avail();
+    image->bufs.data.p = arena_alloc(image->bufs.data.len);
+    image->bufs.write_data = image->bufs.data;
+    printk("Floppy buffers: %u bytes MFM, %u bytes data\n",
+           image->bufs.write_mfm.len, image->bufs.data.len);
+    ASSERT(image->bufs.data.len >= DATA_MIN_LEN);
 
     /* Read MFM buffer overlaps the second half of the write MFM buffer.
      * This is because:
@@ -234,7 +533,7 @@ void floppy_insert(unsigned int unit, struct v2_slot *slot)
 
     /* Read-data buffer can entirely share the space of the write-data buffer. 
      * Change of use of this memory space is fully serialised. */
-    image->bufs.read_data = image->bufs.write_data;
+    image->bufs.read_data = image->bufs.data;
 
     drive.slot = slot;
 
@@ -289,6 +588,79 @@ void floppy_insert(unsigned int unit, struct v2_slot *slot)
     floppy_change_outputs(m(pin_rdy), O_TRUE);
 }
 
+void *floppy_eject(uint32_t scratch_len)
+{
+    struct image_bufs bufs = image->bufs;
+
+    swap.active = FALSE;
+
+    /* Stop DMA/timer work. */
+    IRQx_disable(dma_rdata_irq);
+    IRQx_disable(dma_wdata_irq);
+    timer_cancel(&index.timer);
+
+    /* Outputs as for an empty drive. WRPROT gates off any further writes.
+     * DSKCHG stays asserted until the host steps with the new image 
+     * inserted. */
+    index.active = FALSE;
+    floppy_change_outputs(m(pin_index) | m(pin_rdy), O_FALSE);
+    floppy_change_outputs(m(pin_dskchg) | m(pin_wrprot), O_TRUE);
+
+    IRQ_global_disable();
+    rdata_stop();
+    wdata_stop();
+    drive.image = NULL;
+    drive.slot = NULL;
+    IRQ_global_enable();
+
+    /* A write burst cut short by the eject will never reach DMA_stopping's 
+     * capture_end(): its flux is about to be discarded with the rings. */
+    if (capture.cap)
+        capture_abort(capture.cap);
+
+    /* Empty the DMA rings. */
+    dma_rd->state = dma_wr->state = DMA_inactive;
+    dma_rd->kick_dma_irq = FALSE;
+    dma_rd->cons = dma_rd->prod = 0;
+    dma_wr->cons = dma_wr->prev_sample = 0;
+    dma1->ifcr = DMA_IFCR_CGIF(dma_rdata_ch) | DMA_IFCR_CGIF(dma_wdata_ch);
+    IRQx_clear_pending(dma_rdata_irq);
+    IRQx_clear_pending(dma_wdata_irq);
+
+    /* Forget the image, but keep its buffers. */
+    memset(image, 0, sizeof(*image));
+    image->bufs = bufs;
+    image->bufs.write_mfm.prod = image->bufs.write_mfm.cons = 0;
+    image->bufs.write_mfm.len = WRITE_MFM_LEN;
+    image->bufs.read_mfm.prod = image->bufs.read_mfm.cons = 0;
+    image->bufs.data.prod = image->bufs.data.cons = 0;
+    image->bufs.write_data = image->bufs.read_data = image->bufs.data;
+    max_read_us = 0;
+    memset(&floppy_stats, 0, sizeof(floppy_stats));
+    lat.rd_type = LAT_none;
+
+    IRQx_enable(dma_rdata_irq);
+    IRQx_enable(dma_wdata_irq);
+
+    /* The track-data buffer is idle until reinsertion. */
+    ASSERT(scratch_len <= image->bufs.data.len);
+    return image->bufs.data.p;
+}
+
+void floppy_reinsert(struct v2_slot *slot)
+{
+    swap.active = TRUE;
+    swap.start = stk32_now();
+    swap.open_us = 0;
+
+    drive.slot = slot;
+
+    index.prev_time = stk_now();
+    timer_set(&index.timer, stk_add(index.prev_time, stk_ms(200)));
+
+    floppy_change_outputs(m(pin_rdy), O_TRUE);
+}
+
 /* Called from IRQ context to stop the write stream. */
 static void wdata_stop(void)
 {
@@ -300,6 +672,7 @@ static void wdata_stop(void)
 
     /* Ok we're now stopping DMA activity. */
     dma_wr->state = DMA_stopping;
+    bus_event(EV_wgate_off, 0, stk_now());
 
     /* Turn off timer and DMA. */
     tim_wdata->ccer = 0;
@@ -316,9 +689,32 @@ static void wdata_start(void)
 
     if (dma_wr->state != DMA_inactive) {
         printk("*** Missed write\n");
+        floppy_stats.missed_writes++;
+        bus_event(EV_missed_wr, 0, stk_now());
         return;
     }
     dma_wr->state = DMA_starting;
+    lat.wr_start = stk32_now();
+    lat.rd_type = LAT_none; /* a write is not a read-stream start */
+    bus_event(EV_wgate_on, drive.cyl*2 + drive.head, stk_now());
+
+    /* Read data is now idle: extend the MFM ring up to the staging area. 
+     * Flux fills the dedicated part of the ring first, so any in-flight 
+     * read into the borrowed space completes long before we reach it. */
+    image->bufs.write_mfm.len = ((char *)image->bufs.write_data.p
+                                 - (char *)image->bufs.write_mfm.p) & ~3;
+    write_mfm_stats.peak = write_mfm_stats.overflows = 0;
+
+    if (capture.cap) {
+        /* Captured flux is written to file in whole sectors. The extended 
+         * ring must not reach the capture's own FIL and sector buffer. */
+        ASSERT((char *)capture.cap < (char *)image->bufs.write_mfm.p);
+        image->bufs.write_mfm.len &= ~511;
+        capture.acc = 0;
+        capture.index = FALSE;
+        capture.nr_revs = 1;
+        memset(capture.rev, 0, sizeof(capture.rev));
+    }
 
     /* Start DMA to circular buffer. */
     dma_wdata.cndtr = ARRAY_SIZE(dma_wr->buf);
@@ -343,7 +739,7 @@ static void wdata_start(void)
     start_pos %= stk_ms(DRIVE_MS_PER_REV);
     start_pos *= SYSCLK_MHZ / STK_MHZ;
     image->write_start = start_pos;
-    printk("Write start %u us\n", start_pos / SYSCLK_MHZ);
+    trace(TRACE_DEFAULT, "Write start %u us\n", start_pos / SYSCLK_MHZ);
     delay_us(100); /* XXX X-Copy workaround -- fix me properly!!!! */
 }
 
@@ -382,6 +778,12 @@ static void rdata_start(void)
         goto out;
 
     dma_rd->state = DMA_active;
+    bus_event(EV_flux, image->cur_track, stk_now());
+    if (lat.rd_type != LAT_none) {
+        iostats_latency(lat.rd_type,
+                        stk32_diff(lat.rd_start, stk32_now()) / STK_MHZ);
+        lat.rd_type = LAT_none;
+    }
 
     /* Start DMA from circular buffer. */
     dma_rdata.ccr = (DMA_CCR_PL_HIGH |
@@ -414,9 +816,13 @@ static void floppy_sync_flux(void)
     uint32_t nr;
 
     nr = ARRAY_SIZE(dma_rd->buf) - dma_rd->prod - 1;
-    if (nr)
-        dma_rd->prod += image_rdata_flux(
-            drv->image, &dma_rd->buf[dma_rd->prod], nr);
+    if (nr) {
+        stk_time_t t = stk_now();
+        uint16_t *tbuf = &dma_rd->buf[dma_rd->prod];
+        nr = image_rdata_flux(drv->image, tbuf, nr);
+        flux_audit(drv->image, tbuf, nr, stk_diff(t, stk_now()));
+        dma_rd->prod += nr;
+    }
 
     if (dma_rd->prod < ARRAY_SIZE(dma_rd->buf)/2)
         return;
@@ -425,21 +831,44 @@ static void floppy_sync_flux(void)
     if (ticks > stk_ms(5)) /* ages to wait; go do other work */
         return;
 
-    if (ticks > 0)
-        delay_ticks(ticks);
+    /* Wait for the deadline, unless a step or side change stops us. */
+    while ((stk_delta(stk_now(), sync_time) > stk_us(1))
+           && (dma_rd->state == DMA_starting))
+        cpu_relax();
+    if (dma_rd->state != DMA_starting)
+        return;
     ticks = stk_delta(stk_now(), sync_time); /* XXX */
+    if (ticks < 0) { /* late start: stream lags the index timer */
+        index.resync = TRUE;
+        floppy_stats.late_starts++;
+        iostats_deadline_miss();
+    }
     rdata_start();
-    printk("Trk %u: sync_ticks=%d\n", drv->image->cur_track, ticks);
+    if (swap.active && (dma_rd->state == DMA_active)) {
+        uint32_t us = stk32_diff(swap.start, stk32_now()) / STK_MHZ;
+        printk("Image swap: flux in %u us (open in %u us)\n",
+               us, swap.open_us);
+        iostats_latency(IOLAT_swap_flux, us);
+        swap.active = FALSE;
+    }
+    trace(TRACE_DEFAULT, "Trk %u: sync_ticks=%d\n",
+          drv->image->cur_track, ticks);
 }
 
 static void floppy_read_data(struct drive *drv)
 {
     uint32_t read_us;
     stk_time_t timestamp;
+    bool_t read;
+
+    /* Abandon the track load if a step or side change has stopped us. */
+    if (dma_rd->state == DMA_stopping)
+        return;
 
     /* Read some track data if there is buffer space. */
     timestamp = stk_now();
-    if (image_read_track(drv->image) && dma_rd->kick_dma_irq) {
+    read = image_read_track(drv->image);
+    if (read && dma_rd->kick_dma_irq) {
         /* We buffered some more data and the DMA handler requested a kick. */
         dma_rd->kick_dma_irq = FALSE;
         IRQx_set_pending(dma_rdata_irq);
@@ -447,6 +876,8 @@ static void floppy_read_data(struct drive *drv)
 
     /* Log maximum time taken to read track data, in microseconds. */
     read_us = stk_diff(timestamp, stk_now()) / STK_MHZ;
+    if (read)
+        iostats_latency(IOLAT_track_read, read_us);
     if (read_us > max_read_us) {
         max_read_us = max_t(uint32_t, max_read_us, read_us);
         printk("New max: read_us=%u\n", max_read_us);
@@ -455,6 +886,28 @@ static void floppy_read_data(struct drive *drv)
 
 static bool_t dma_rd_handle(struct drive *drv)
 {
+    bool_t cached;
+
+    /* Nobody listens to a deselected drive: pause the read stream, and so 
+     * USB reads, if we stay deselected. The index timer keeps time, so the 
+     * stream restarts at the correct rotational position. Suspension is 
+     * sticky until reselect, as the STK timer soon wraps. */
+    if (drv->sel) {
+        drv->desel = drv->suspended = FALSE;
+    } else if (!drv->desel) {
+        drv->desel = TRUE;
+        drv->desel_start = stk_now();
+    } else if (!drv->suspended
+               && (stk_timesince(drv->desel_start)
+                   >= stk_ms(DESEL_SUSPEND_MS))) {
+        drv->suspended = TRUE;
+        IRQ_global_disable();
+        if ((dma_rd->state == DMA_starting) || (dma_rd->state == DMA_active))
+            rdata_stop();
+        lat.rd_type = LAT_none; /* the host has stopped waiting */
+        IRQ_global_enable();
+    }
+
     switch (dma_rd->state) {
 
     case DMA_inactive: {
@@ -462,6 +915,13 @@ static bool_t dma_rd_handle(struct drive *drv)
         unsigned int track;
         /* Allow 10ms from current rotational position to load new track */
         int32_t delay = stk_ms(10);
+        if (drv->suspended)
+            break;
+        /* A track held in RAM needs only time to prime the flux ring. */
+        track = drv->cyl*2 + drv->head;
+        cached = image_track_cached(drv->image, track);
+        if (cached)
+            delay = stk_ms(2);
         /* Allow extra time if heads are settling. */
         if (drv->step.state & STEP_settling) {
             stk_time_t step_settle = stk_add(drv->step.start,
@@ -473,6 +933,21 @@ static bool_t dma_rd_handle(struct drive *drv)
         barrier(); /* check STEP_settling /then/ check STEP_active */
         if (drv->step.state & STEP_active)
             break;
+        /* Nor while the host appears to be mid-way through a multi-cylinder 
+         * seek: hold off until the next step of the burst is overdue, so 
+         * that only the destination cylinder is read. */
+        if (drv->step.burst) {
+            /* IRQ_step() may update the burst under our feet. */
+            uint32_t oldpri = IRQ_save(FLOPPY_IRQ_LO_PRI);
+            uint32_t burst = drv->step.burst;
+            bool_t overdue = (stk_timesince(drv->step.start)
+                              >= (burst + burst/4));
+            if (overdue)
+                drv->step.burst = 0;
+            IRQ_restore(oldpri);
+            if (!overdue)
+                break;
+        }
         /* Work out where in new track to start reading data from. */
         index_time = index.prev_time;
         read_start_pos = stk_timesince(index_time) + delay;
@@ -484,6 +959,11 @@ static bool_t dma_rd_handle(struct drive *drv)
         if (image_seek_track(drv->image, track, &read_start_pos))
             return TRUE;
         read_start_pos /= SYSCLK_MHZ/STK_MHZ;
+        floppy_stats.track_loads++;
+        if (cached)
+            floppy_stats.cached_loads++;
+        trace(TRACE_VERBOSE, "Seek trk %u%s\n",
+              track, cached ? " (cached)" : "");
         /* Set the deadline. */
         sync_time = stk_add(index_time, read_start_pos);
         if (stk_delta(stk_now(), sync_time) < 0)
@@ -500,7 +980,10 @@ static bool_t dma_rd_handle(struct drive *drv)
 
     case DMA_starting:
         floppy_read_data(drv);
-        floppy_sync_flux();
+        /* Abandon the load if a step or side change stopped us during the 
+         * read: do not prime and wait to sync a dead stream. */
+        if (dma_rd->state == DMA_starting)
+            floppy_sync_flux();
         break;
 
     case DMA_active:
@@ -511,29 +994,122 @@ static bool_t dma_rd_handle(struct drive *drv)
         dma_rd->state = DMA_inactive;
         /* Reinitialise the circular buffer to empty. */
         dma_rd->cons = dma_rd->prod = 0;
-        /* Free-running index timer. */
-        if (!index.active)
-            timer_set(&index.timer, stk_add(index.prev_time, stk_ms(200)));
+        audit_restart();
         break;
     }
 
     return FALSE;
 }
 
+/* Write captured flux to file: whole sectors only, unless @final. */
+static void capture_flush(bool_t final)
+{
+    struct image_buf *buf = &image->bufs.write_mfm;
+    uint32_t prod = buf->prod, off, nr;
+
+    barrier(); /* take producer index /then/ read the ring */
+
+    for (;;) {
+        off = buf->cons % buf->len;
+        nr = min(prod - buf->cons, buf->len - off);
+        if (!final)
+            nr &= ~511;
+        if (nr == 0)
+            break;
+        capture_write(capture.cap, (char *)buf->p + off, nr);
+        buf->cons += nr;
+    }
+}
+
 void floppy_get_track(uint8_t *p_cyl, uint8_t *p_side)
 {
     *p_cyl = drive.cyl;
     *p_side = drive.head;
 }
 
+#if !defined(NDEBUG) || defined(CONSOLE_CMDS)
+
+static const char *dma_state_name(uint8_t state)
+{
+    static const char *names[] = {
+        "inactive", "starting", "active", "stopping"
+    };
+    return (state < ARRAY_SIZE(names)) ? names[state] : "?";
+}
+
+void floppy_dump_state(void)
+{
+    struct drive *drv = &drive;
+
+    printk("Drive: cyl %u head %u %s, step %x%s\n",
+           drv->cyl, drv->head, drv->sel ? "selected" : "deselected",
+           drv->step.state,
+           drv->suspended ? ", suspended" : drv->desel ? ", desel" : "");
+    if (!dma_rd) {
+        printk("No image\n");
+        return;
+    }
+    printk("Image: %s, trk %u, cached trk %d\n",
+           drv->image ? "open" : "opening",
+           image->cur_track, (int16_t)image->cached_track);
+    printk("RDATA: %s, WDATA: %s, index resync %u\n",
+           dma_state_name(dma_rd->state), dma_state_name(dma_wr->state),
+           index.resync);
+}
+
+static void dump_buf(const char *name, const struct image_buf *b)
+{
+    printk(" %s: prod %u cons %u len %u\n", name, b->prod, b->cons, b->len);
+}
+
+void floppy_dump_bufs(void)
+{
+    uint16_t mask = ARRAY_SIZE(dma_rd->buf) - 1;
+
+    if (!dma_rd) {
+        printk("No image\n");
+        return;
+    }
+    printk("DMA rings (of %u): RDATA %u, WDATA %u\n",
+           ARRAY_SIZE(dma_rd->buf),
+           (dma_rd->prod - dma_rd->cons) & mask,
+           (ARRAY_SIZE(dma_wr->buf) - dma_wdata.cndtr - dma_wr->cons) & mask);
+    dump_buf("read_mfm", &image->bufs.read_mfm);
+    dump_buf("read_data", &image->bufs.read_data);
+    dump_buf("write_mfm", &image->bufs.write_mfm);
+    dump_buf("write_data", &image->bufs.write_data);
+    printk("Write MFM peak %u bytes\n", write_mfm_stats.peak);
+}
+
+void floppy_dump_stats(void)
+{
+    uint32_t loads = floppy_stats.track_loads;
+
+    printk("Track loads: %u, from cache: %u (%u%%)\n",
+           loads, floppy_stats.cached_loads,
+           loads ? (floppy_stats.cached_loads * 100) / loads : 0);
+    printk("Max read: %u us\n", max_read_us);
+    printk("Late starts: %u, RDATA underruns: %u\n",
+           floppy_stats.late_starts, floppy_stats.underruns);
+    printk("Write bursts: %u, MFM overflows: %u, missed: %u\n",
+           floppy_stats.write_bursts, floppy_stats.write_overflows,
+           floppy_stats.missed_writes);
+}
+
+#endif /* !NDEBUG || CONSOLE_CMDS */
+
 bool_t floppy_handle(void)
 {
     struct drive *drv = &drive;
 
+    audit_report();
+
     if (!drv->image) {
         if (!image_open(image, drv->slot))
             return TRUE;
         drv->image = image;
+        if (swap.active)
+            swap.open_us = stk32_diff(swap.start, stk32_now()) / STK_MHZ;
         dma_rd->state = DMA_stopping;
         if (image->handler->write_track)
             floppy_change_outputs(m(pin_wrprot), O_FALSE);
@@ -559,13 +1135,20 @@ bool_t floppy_handle(void)
         track = drv->cyl*2 + drv->head;
         if (image_seek_track(drv->image, track, NULL))
             return TRUE;
+        if (capture.cap)
+            capture_begin(capture.cap, track);
         /* May race wdata_stop(). */
-        cmpxchg(&dma_wr->state, DMA_starting, DMA_active);
+        if (cmpxchg(&dma_wr->state, DMA_starting, DMA_active) == DMA_starting)
+            iostats_latency(IOLAT_wgate_capture,
+                            stk32_diff(lat.wr_start, stk32_now()) / STK_MHZ);
         break;
     }
 
     case DMA_active:
-        image_write_track(drv->image, FALSE);
+        if (capture.cap)
+            capture_flush(FALSE);
+        else
+            image_write_track(drv->image, FALSE);
         break;
 
     case DMA_stopping: {
@@ -574,15 +1157,28 @@ bool_t floppy_handle(void)
         uint16_t prod = ARRAY_SIZE(dma_wr->buf) - dma_wdata.cndtr;
         uint16_t cons = dma_wr->cons;
         barrier(); /* take dma indexes /then/ process data tail */
-        image_write_track(drv->image, cons == prod);
+        if (capture.cap)
+            capture_flush(cons == prod);
+        else
+            image_write_track(drv->image, cons == prod);
         if (cons != prod)
             break;
         /* Clear the flux ring, flush dirty buffers. */
         dma_wr->cons = 0;
         dma_wr->prev_sample = 0;
+        trace(TRACE_DEFAULT, "Write MFM peak %u/%u bytes, %u overflows\n",
+              write_mfm_stats.peak, image->bufs.write_mfm.len,
+              write_mfm_stats.overflows);
+        floppy_stats.write_bursts++;
+        floppy_stats.write_overflows += write_mfm_stats.overflows;
+        iostats_write_overruns(write_mfm_stats.overflows);
         image->bufs.write_mfm.cons = image->bufs.write_data.cons = 0;
         image->bufs.write_mfm.prod = image->bufs.write_data.prod = 0;
-        F_sync(&drv->image->fp);
+        image->bufs.write_mfm.len = WRITE_MFM_LEN;
+        if (capture.cap)
+            capture_end(capture.cap, capture.rev, capture.nr_revs);
+        else
+            F_sync(&drv->image->fp);
         barrier(); /* allow reactivation of write path /last/ */
         dma_wr->state = DMA_inactive;
         break;
@@ -598,11 +1194,18 @@ static void index_pulse(void *dat)
     if (index.active) {
         index.prev_time = index.timer.deadline;
         floppy_change_outputs(m(pin_index), O_TRUE);
+        if (capture.cap && (dma_wr->state == DMA_active)) {
+            /* Mark where the index falls in the captured flux. */
+            capture.index_pos = ARRAY_SIZE(dma_wr->buf) - dma_wdata.cndtr;
+            barrier(); /* set position /then/ flag */
+            capture.index = TRUE;
+        }
         timer_set(&index.timer, stk_add(index.prev_time, stk_ms(2)));
     } else {
         floppy_change_outputs(m(pin_index), O_FALSE);
-        if (dma_rd->state != DMA_active) /* timer set from input flux stream */
-            timer_set(&index.timer, stk_add(index.prev_time, stk_ms(200)));
+        /* Image revolutions are exactly 200ms, so the index timer free-runs 
+         * in step with the flux stream. */
+        timer_set(&index.timer, stk_add(index.prev_time, stk_ms(200)));
     }
 }
 
@@ -619,7 +1222,8 @@ static void drive_step_timer(void *_drv)
         if ((drv->cyl >= 84) && !drv->step.inward)
             drv->cyl = 84; /* Fast step back from D-A cyl 255 */
         drv->cyl += drv->step.inward ? 1 : -1;
-        timer_set(&drv->step.timer, stk_add(drv->step.start, DRIVE_SETTLE_MS));
+        timer_set(&drv->step.timer,
+                  stk_add(drv->step.start, stk_ms(DRIVE_SETTLE_MS)));
         if (drv->cyl == 0)
             floppy_change_outputs(m(pin_trk0), O_TRUE);
         /* New state last, as that lets hi-pri IRQ start another step. */
@@ -638,6 +1242,15 @@ static void IRQ_step(void)
     struct drive *drv = &drive;
 
     if (drv->step.state == STEP_started) {
+        /* Predict a multi-step burst from step rate and direction. */
+        uint32_t interval = stk_diff(drv->step.prev_start, drv->step.start);
+        bus_event(EV_step, drv->step.inward, drv->step.start);
+        lat_read_from(IOLAT_step_flux, drv->step.start);
+        drv->step.burst = ((drv->step.inward == drv->step.prev_inward)
+                           && (interval < stk_ms(STEP_BURST_MS)))
+            ? interval : 0;
+        drv->step.prev_start = drv->step.start;
+        drv->step.prev_inward = drv->step.inward;
         timer_cancel(&drv->step.timer);
         drv->step.state = STEP_latched;
         timer_set(&drv->step.timer, stk_add(drv->step.start, stk_ms(2)));
@@ -651,6 +1264,7 @@ static void IRQ_rdata_dma(void)
     uint16_t nr_to_wrap, nr_to_cons, nr, dmacons, done;
     stk_time_t now;
     struct drive *drv = &drive;
+    uint16_t *tbuf;
 
     /* Clear DMA peripheral interrupts. */
     dma1->ifcr = DMA_IFCR_CGIF(dma_rdata_ch);
@@ -666,9 +1280,14 @@ static void IRQ_rdata_dma(void)
     if (((dmacons < dma_rd->cons)
          ? (dma_rd->prod >= dma_rd->cons) || (dma_rd->prod < dmacons)
          : (dma_rd->prod >= dma_rd->cons) && (dma_rd->prod < dmacons))
-        && (dmacons != dma_rd->cons))
+        && (dmacons != dma_rd->cons)) {
         printk("RDATA underrun! %x-%x-%x\n",
                dma_rd->cons, dma_rd->prod, dmacons);
+        index.resync = TRUE;
+        floppy_stats.underruns++;
+        bus_event(EV_underrun, 0, stk_now());
+        iostats_deadline_miss();
+    }
 
     dma_rd->cons = dmacons;
 
@@ -682,9 +1301,11 @@ static void IRQ_rdata_dma(void)
     /* Now attempt to fill the contiguous stretch with flux data calculated 
      * from buffered image data. */
     prev_ticks_since_index = image_ticks_since_index(drv->image);
-    dma_rd->prod += done = image_rdata_flux(
-        drv->image, &dma_rd->buf[dma_rd->prod], nr);
+    tbuf = &dma_rd->buf[dma_rd->prod];
+    now = stk_now();
+    dma_rd->prod += done = image_rdata_flux(drv->image, tbuf, nr);
     dma_rd->prod &= buf_mask;
+    flux_audit(drv->image, tbuf, done, stk_diff(now, stk_now()));
     if (done != nr) {
         /* Read buffer ran dry: kick us when more data is available. */
         dma_rd->kick_dma_irq = TRUE;
@@ -697,7 +1318,13 @@ static void IRQ_rdata_dma(void)
     if (image_ticks_since_index(drv->image) >= prev_ticks_since_index)
         return;
 
-    /* We crossed the index mark: Synchronise index pulse to the bitstream. */
+    /* We crossed the index mark. The index timer is already in phase with 
+     * the bitstream unless the stream stalled since the last crossing. */
+    if (!index.resync)
+        return;
+    index.resync = FALSE;
+
+    /* Synchronise index pulse to the bitstream. */
     for (;;) {
         /* Snapshot current position in flux stream, including progress through
          * current timer sample. */
@@ -722,13 +1349,70 @@ static void IRQ_rdata_dma(void)
     timer_set(&index.timer, stk_add(now, ticks));
 }
 
+/* IRQ_wdata_dma() in capture mode: flux intervals are converted to 25ns 
+ * units and stored big-endian in the write_mfm ring, split into segments 
+ * at index pulses. The ring is drained to file by capture_flush(). */
+static void wdata_capture(void)
+{
+    const uint16_t buf_mask = ARRAY_SIZE(dma_wr->buf) - 1;
+    struct image_buf *mfm = &image->bufs.write_mfm;
+    struct capture_rev *rev = &capture.rev[capture.nr_revs-1];
+    uint16_t *ring = mfm->p;
+    uint16_t cons, prod, prev, next, index_pos = capture.index_pos;
+    uint32_t v, acc, depth, prodb = mfm->prod;
+    uint32_t idx = (prodb % mfm->len) / 2, ringlen = mfm->len / 2;
+    bool_t index = capture.index;
+
+    barrier(); /* take index mark /then/ DMA producer index */
+    prod = ARRAY_SIZE(dma_wr->buf) - dma_wdata.cndtr;
+
+    prev = dma_wr->prev_sample;
+    acc = capture.acc;
+    for (cons = dma_wr->cons; cons != prod; cons = (cons+1) & buf_mask) {
+        if (index && (cons == index_pos)) {
+            index = capture.index = FALSE;
+            if (capture.nr_revs < CAPTURE_MAX_REVS)
+                rev = &capture.rev[capture.nr_revs++];
+        }
+        next = dma_wr->buf[cons];
+        /* 25ns units, carrying the remainder so that time does not drift. */
+        acc += (uint16_t)(next - prev) * 40u;
+        prev = next;
+        v = acc / SYSCLK_MHZ;
+        acc -= v * SYSCLK_MHZ;
+        rev->duration += v;
+        if ((prodb - mfm->cons) >= mfm->len) {
+            /* Ring full: mass storage has fallen behind. Drop the sample. */
+            write_mfm_stats.overflows++;
+            continue;
+        }
+        ring[idx] = htobe16(v);
+        if (++idx == ringlen)
+            idx = 0;
+        prodb += 2;
+        rev->nr_flux++;
+    }
+
+    /* Save our progress for next time. */
+    mfm->prod = prodb;
+    dma_wr->cons = cons;
+    dma_wr->prev_sample = prev;
+    capture.acc = acc;
+
+    depth = prodb - mfm->cons;
+    if (depth > write_mfm_stats.peak)
+        write_mfm_stats.peak = depth;
+}
+
 static void IRQ_wdata_dma(void)
 {
     const uint16_t buf_mask = ARRAY_SIZE(dma_rd->buf) - 1;
     uint16_t cons, prod, prev, curr, next;
-    uint32_t mfm = 0, mfmprod, syncword = image->handler->syncword;
+    uint32_t mfm = 0, mfmprod, mfmcons, depth;
+    uint32_t syncword = image->handler->syncword;
     uint32_t *mfmbuf = image->bufs.write_mfm.p;
     unsigned int mfmbuflen = image->bufs.write_mfm.len / 4;
+    bool_t lsb_first = image->handler->write_lsb_first;
 
     /* Clear DMA peripheral interrupts. */
     dma1->ifcr = DMA_IFCR_CGIF(dma_wdata_ch);
@@ -737,39 +1421,92 @@ static void IRQ_wdata_dma(void)
     if (dma_wr->state == DMA_inactive)
         return;
 
+    if (capture.cap) {
+        wdata_capture();
+        return;
+    }
+
     /* Find out where the DMA engine's producer index has got to. */
     prod = ARRAY_SIZE(dma_wr->buf) - dma_wdata.cndtr;
 
-    /* Process the flux timings into the MFM raw buffer. */
+    /* Process the flux timings into the MFM raw buffer. Bitcells are 
+     * shifted in at the bottom of big-endian words or, for handlers which 
+     * take them LSB-first, at the top of little-endian words. A completed 
+     * word that would overwrite unconsumed data is dropped instead: the 
+     * consumer only advances, so a stale consumer index errs safe. */
+#define store_mfm(w) do {                                       \
+    if ((mfmprod - mfmcons) > mfmbuflen*32) {                   \
+        mfmprod -= 32;                                          \
+        write_mfm_stats.overflows++;                            \
+    } else {                                                    \
+        mfmbuf[((mfmprod-1) / 32) % mfmbuflen] = (w);           \
+    }                                                           \
+} while (0)
     prev = dma_wr->prev_sample;
     mfmprod = image->bufs.write_mfm.prod;
-    if (mfmprod & 31)
-        mfm = be32toh(mfmbuf[(mfmprod / 32) % mfmbuflen]) >> (-mfmprod&31);
-    for (cons = dma_wr->cons; cons != prod; cons = (cons+1) & buf_mask) {
-        next = dma_wr->buf[cons];
-        curr = next - prev;
-        prev = next;
-        while (curr > 3*SYSCLK_MHZ) {
-            curr -= 2*SYSCLK_MHZ;
-            mfm <<= 1;
+    mfmcons = image->bufs.write_mfm.cons & ~31; /* consumer's word */
+    if (mfmprod & 31) {
+        mfm = mfmbuf[(mfmprod / 32) % mfmbuflen];
+        mfm = lsb_first ? le32toh(mfm) << (-mfmprod&31)
+            : be32toh(mfm) >> (-mfmprod&31);
+    }
+    if (lsb_first) {
+        syncword = _rbit32(syncword);
+        for (cons = dma_wr->cons; cons != prod; cons = (cons+1) & buf_mask) {
+            next = dma_wr->buf[cons];
+            curr = next - prev;
+            prev = next;
+            while (curr > 3*SYSCLK_MHZ) {
+                curr -= 2*SYSCLK_MHZ;
+                mfm >>= 1;
+                mfmprod++;
+                if (!(mfmprod&31))
+                    store_mfm(htole32(mfm));
+            }
+            mfm = (mfm >> 1) | 0x80000000u;
+            mfmprod++;
+            if (mfm == syncword)
+                mfmprod &= ~31;
+            if (!(mfmprod&31))
+                store_mfm(htole32(mfm));
+        }
+    } else {
+        for (cons = dma_wr->cons; cons != prod; cons = (cons+1) & buf_mask) {
+            next = dma_wr->buf[cons];
+            curr = next - prev;
+            prev = next;
+            while (curr > 3*SYSCLK_MHZ) {
+                curr -= 2*SYSCLK_MHZ;
+                mfm <<= 1;
+                mfmprod++;
+                if (!(mfmprod&31))
+                    store_mfm(htobe32(mfm));
+            }
+            mfm = (mfm << 1) | 1;
             mfmprod++;
+            if (mfm == syncword)
+                mfmprod &= ~31;
             if (!(mfmprod&31))
-                mfmbuf[((mfmprod-1) / 32) % mfmbuflen] = htobe32(mfm);
+                store_mfm(htobe32(mfm));
         }
-        mfm = (mfm << 1) | 1;
-        mfmprod++;
-        if (mfm == syncword)
-            mfmprod &= ~31;
-        if (!(mfmprod&31))
-            mfmbuf[((mfmprod-1) / 32) % mfmbuflen] = htobe32(mfm);
     }
 
-    /* Save our progress for next time. */
-    if (mfmprod & 31)
-        mfmbuf[(mfmprod / 32) % mfmbuflen] = htobe32(mfm << (-mfmprod&31));
+#undef store_mfm
+
+    /* Save our progress for next time. The partial word is kept only if it 
+     * lies clear of unconsumed data: else its bits are lost, as if dropped. */
+    if ((mfmprod & 31) && (((mfmprod + 31) & ~31) - mfmcons <= mfmbuflen*32))
+        mfmbuf[(mfmprod / 32) % mfmbuflen] = lsb_first
+            ? htole32(mfm >> (-mfmprod&31))
+            : htobe32(mfm << (-mfmprod&31));
     image->bufs.write_mfm.prod = mfmprod;
     dma_wr->cons = cons;
     dma_wr->prev_sample = prev;
+
+    /* Track how far ahead of mass storage we are running. */
+    depth = (mfmprod - image->bufs.write_mfm.cons) / 8;
+    if (depth > write_mfm_stats.peak)
+        write_mfm_stats.peak = depth;
 }
 
 /*
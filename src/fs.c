@@ -79,6 +79,20 @@ void F_read(FIL *fp, void *buff, UINT btr, UINT *br)
     handle_fr(fr);
 }
 
+void F_read_sg(FIL *fp, const DSEG *seg, UINT nseg)
+{
+    UINT br, n;
+    FRESULT fr = f_read_sg(fp, seg, nseg, &br);
+    /* Zero-fill past end of file, as F_read() does. */
+    for (; nseg != 0; seg++, nseg--) {
+        n = min_t(UINT, br, seg->len);
+        if (seg->buff != NULL)
+            memset(seg->buff + n, 0, seg->len - n);
+        br -= n;
+    }
+    handle_fr(fr);
+}
+
 void F_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
 {
     UINT _bw;
@@ -134,6 +148,13 @@ void F_findfirst(DIR *dp, FILINFO *fno, const TCHAR *path,
     handle_fr(fr);
 }
 
+void F_findfrom(DIR *dp, FILINFO *fno, const TCHAR *path,
+                const TCHAR *pattern, DWORD ofs)
+{
+    FRESULT fr = f_findfrom(dp, fno, path, pattern, ofs);
+    handle_fr(fr);
+}
+
 void F_findnext(DIR *dp, FILINFO *fno)
 {
     FRESULT fr = f_findnext(dp, fno);
@@ -155,7 +155,7 @@ static void IRQ_STEP_changed(void)
         return;
 
     /* DSKCHG asserts on any falling edge of STEP. We deassert on any edge. */
-    if ((gpio_out_active & m(pin_dskchg)) && (dma_rd != NULL))
+    if ((gpio_out_active & m(pin_dskchg)) && (drv->slot != NULL))
         floppy_change_outputs(m(pin_dskchg), O_FALSE);
 
     if (!(idr_a & m(pin_step))   /* Not rising edge on STEP? */
@@ -185,6 +185,8 @@ static void IRQ_SIDE_changed(void)
     exti->pr = m(pin_side);
 
     drv->head = !(gpiob->idr & m(pin_side));
+    bus_event(EV_side, drv->head, stk_now());
+    lat_read_from(IOLAT_side_flux, stk_now());
     if (dma_rd != NULL)
         rdata_stop();
 }
@@ -6,7 +6,9 @@
  * 
  * TM1651 specified f_max is 500kHz with 50% duty cycle, so clock should change 
  * change value no more often than 1us. We clock with half-cycle 20us so we
- * are very conservative.
+ * are very conservative. Commands are queued and clocked out by a state 
+ * machine in a low-priority soft IRQ, paced by a timer, so callers never 
+ * wait on the display and the floppy interrupts are never held off.
  * 
  * Written & released by Keir Fraser <keir.xen@gmail.com>
  * 
@@ -14,8 +16,15 @@
  * See the file COPYING for more details, or visit <http://unlicense.org>.
  */
 
-/* Full clock cycle is 8us (freq = 125kHZ) */
-#define CYCLE 8
+/* Full clock cycle is 40us (freq = 25kHz). The protocol is clocked by a 
+ * state machine driven from timer callbacks, so a slow clock costs the rest 
+ * of the system nothing but a few interrupts per bit. */
+#define CYCLE 40
+
+/* A soft IRQ for running the state machine: the timer callback only pends 
+ * it, so the pin bit-banging runs below all floppy interrupts. */
+void IRQ_45(void) __attribute__((alias("IRQ_led")));
+#define LED_IRQ 45
 
 /* Brightness range is 0-7: 
  * 0 is very dim
@@ -37,6 +46,30 @@ static const uint8_t digits[] = {
     0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f
 };
 
+/* Queue of commands. Each command is one START-bytes-STOP sequence. */
+struct cmd {
+    uint8_t len;
+    uint8_t dat[5];
+};
+static struct cmd cmdq[8];
+static volatile uint8_t cmd_cons, cmd_prod;
+#define CMDQ_MASK (ARRAY_SIZE(cmdq) - 1)
+
+/* State of the command at the head of the queue. */
+static struct {
+    struct timer timer;
+    volatile bool_t busy; /* state machine is running */
+    volatile bool_t fail; /* last completed command was not ACKed */
+    bool_t nack;
+    uint8_t retry;
+    uint8_t byte;  /* index into current command's bytes */
+    uint16_t y;    /* bits remaining in current byte, plus ACK marker */
+    uint8_t step;  /* position in current START, bit, or STOP phase */
+#define ST_start 0
+#define ST_bit   4
+#define ST_stop  8
+} sm;
+
 static void set_pin(uint8_t pin, uint8_t level)
 {
     /* Simulate open drain with passive pull up. */
@@ -49,88 +82,150 @@ static void set_pin(uint8_t pin, uint8_t level)
 #define set_dat(level) set_pin(DAT_PIN, level)
 #define set_clk(level) set_pin(CLK_PIN, level)
 
-static bool_t write(uint8_t x)
+/* Perform the next step of the current command. Returns microseconds until 
+ * the following step, or 0 if the command is complete. */
+static unsigned int cmd_step(struct cmd *c)
 {
-    bool_t fail = FALSE;
-    uint16_t y = x | 0x100;
+    switch (sm.step++) {
+
+    /* START: DAT HIGH-to-LOW while CLK is HIGH. */
+    case ST_start+0:
+        sm.nack = FALSE;
+        sm.byte = 0;
+        set_clk(LOW);
+        return CYCLE/2;
+    case ST_start+1:
+        set_clk(HIGH);
+        return CYCLE/4;
+    case ST_start+2:
+        set_dat(LOW);
+        sm.y = c->dat[0] | 0x100;
+        sm.step = ST_bit;
+        return CYCLE/4;
 
     /* 8 data bits, LSB first, driven onto DAT line while CLK is LOW.
      * Check for ACK during 9th CLK LOW half-period: we pull DAT HIGH
      * but TM1651 should drive DAT LOW. */
-    do {
+    case ST_bit+0:
         set_clk(LOW);
-        delay_us(CYCLE/4);
-
-        set_dat(y & 1);
-        delay_us(CYCLE/8);
-        if (y == 1) {
+        return CYCLE/4;
+    case ST_bit+1:
+        set_dat(sm.y & 1);
+        return CYCLE/8;
+    case ST_bit+2:
+        if (sm.y == 1) {
             /* ACK: has TM1651 driven DAT LOW? */
-            fail = gpio_read_pin(gpiob, DAT_PIN);
+            sm.nack = gpio_read_pin(gpiob, DAT_PIN);
             /* Now we must drive it LOW ourselves before TM1651 releases. */
             set_dat(0);
         }
-        delay_us(CYCLE/8);
-
+        return CYCLE/8;
+    case ST_bit+3:
         set_clk(HIGH);
-        delay_us(CYCLE/2);
+        if ((sm.y >>= 1) != 0) {
+            sm.step = ST_bit;
+        } else if (!sm.nack && (++sm.byte < c->len)) {
+            sm.y = c->dat[sm.byte] | 0x100;
+            sm.step = ST_bit;
+        } else {
+            sm.step = ST_stop;
+        }
+        return CYCLE/2;
 
-    } while (y >>= 1);
+    /* STOP: DAT LOW-to-HIGH while CLK is HIGH. */
+    case ST_stop+0:
+        set_clk(LOW);
+        return CYCLE/2;
+    case ST_stop+1:
+        set_clk(HIGH);
+        return CYCLE/4;
+    case ST_stop+2:
+        set_dat(HIGH);
+        return CYCLE/4;
+    }
 
-    return fail;
+    return 0;
 }
 
-static void start(void)
+static void timer_fn(void *unused)
 {
-    /* DAT HIGH-to-LOW while CLK is HIGH. */
-    set_clk(LOW);
-    delay_us(CYCLE/2);
-
-    set_clk(HIGH);
-    delay_us(CYCLE/4);
-
-    set_dat(LOW);
-    delay_us(CYCLE/4);
+    IRQx_set_pending(LED_IRQ);
 }
 
-static void stop(void)
+static void IRQ_led(void)
 {
-    /* DAT LOW-to-HIGH while CLK is HIGH. */
-    set_clk(LOW);
-    delay_us(CYCLE/2);
-
-    set_clk(HIGH);
-    delay_us(CYCLE/4);
+    unsigned int us;
+
+    while ((us = cmd_step(&cmdq[cmd_cons & CMDQ_MASK])) == 0) {
+        sm.step = ST_start;
+        /* Retry a command which is not ACKed, up to 3 attempts in all. */
+        if (sm.nack && (++sm.retry < 3))
+            continue;
+        sm.fail = sm.nack;
+        sm.retry = 0;
+        if (++cmd_cons == cmd_prod) {
+            sm.busy = FALSE;
+            return;
+        }
+    }
 
-    set_dat(HIGH);
-    delay_us(CYCLE/4);
+    /* Pace from now, not the last deadline: a late soft IRQ must not 
+     * squeeze the following steps together. */
+    timer_set(&sm.timer, stk_add(stk_now(), stk_us(us)));
 }
 
-static bool_t send_cmd(uint8_t cmd)
+static void queue_cmd(const uint8_t *dat, uint8_t len)
 {
-    bool_t fail = TRUE;
-    int retry;
+    uint32_t oldpri;
+    struct cmd *c;
+
+    /* Wait for space in the queue. */
+    while ((uint8_t)(cmd_prod - cmd_cons) > CMDQ_MASK)
+        cpu_relax();
+
+    oldpri = IRQ_save(LED_IRQ_PRI);
+
+    /* A display update supersedes a queued update not yet started. */
+    c = &cmdq[(cmd_prod - 1) & CMDQ_MASK];
+    if (((uint8_t)(cmd_prod - cmd_cons) >= 2)
+        && (dat[0] == 0xc0) && (c->dat[0] == 0xc0)) {
+        memcpy(c->dat, dat, len);
+    } else {
+        c = &cmdq[cmd_prod & CMDQ_MASK];
+        c->len = len;
+        memcpy(c->dat, dat, len);
+        cmd_prod++;
+    }
 
-    for (retry = 0; fail && (retry < 3); retry++) {
-        start();
-        fail = write(cmd);
-        stop();
+    /* Kick the state machine if it is idle. */
+    if (!sm.busy) {
+        sm.busy = TRUE;
+        timer_set(&sm.timer, stk_now());
     }
 
-    return fail;
+    IRQ_restore(oldpri);
+}
+
+/* Wait for all queued commands to complete. */
+void led_3dig_sync(void)
+{
+    while (sm.busy)
+        cpu_relax();
 }
 
 void led_3dig_display_setting(bool_t enable)
 {
-    send_cmd(enable ? 0x88 + BRIGHTNESS : 0x80);
+    uint8_t cmd = enable ? 0x88 + BRIGHTNESS : 0x80;
+    queue_cmd(&cmd, 1);
 }
 
 void led_3dig_write(const char *p)
 {
-    bool_t fail = TRUE;
-    uint8_t d[3], c;
-    int i, retry;
+    uint8_t d[5], c;
+    int i;
 
-    for (i = 0; i < 3; i++) {
+    d[0] = 0xc0; /* set addr 0 */
+    for (i = 1; i <= 3; i++) {
         c = *p++;
         if ((c >= '0') && (c <= '9')) {
             d[i] = digits[c - '0'];
@@ -144,34 +239,41 @@ void led_3dig_write(const char *p)
             d[i] = 0;
         }
     }
+    d[4] = 0x00; /* dat3 */
 
-    for (retry = 0; fail && (retry < 3); retry++) {
-        start();
-        fail = (write(0xc0)      /* set addr 0 */
-                || write(d[0])   /* dat0 */
-                || write(d[1])   /* dat1 */
-                || write(d[2])   /* dat2 */
-                || write(0x00)); /* dat3 */
-        stop();
-    }
+    queue_cmd(d, sizeof(d));
 }
 
 bool_t led_3dig_init(void)
 {
+    uint8_t cmd = 0x40;
+
+    timer_init(&sm.timer, timer_fn, NULL);
+    sm.step = ST_start;
+
+    IRQx_set_prio(LED_IRQ, LED_IRQ_PRI);
+    IRQx_enable(LED_IRQ);
+
     set_dat(HIGH);
     set_clk(HIGH);
 
     /* Data command: write registers, auto-increment address. 
      * Also check the controller is sending ACKs. If not, we must assume 
      * no LED controller is attached. */
-    if (send_cmd(0x40))
+    queue_cmd(&cmd, 1);
+    led_3dig_sync();
+    if (sm.fail)
         return FALSE;
 
     /* Clear the registers. */
     led_3dig_write("    ");
 
     /* Display control: brightness. */
-    send_cmd(0x88 + BRIGHTNESS);
+    led_3dig_display_setting(TRUE);
+
+    /* Finish before other GPIOB pins are configured: we must not race their 
+     * read-modify-write of the port configuration registers. */
+    led_3dig_sync();
 
     return TRUE;
 }
@@ -38,7 +38,7 @@ uint32_t  HCD_HC_Init              (USB_OTG_CORE_HANDLE *pdev ,
 uint32_t  HCD_SubmitRequest        (USB_OTG_CORE_HANDLE *pdev ,
                                     uint8_t hc_num) ;
 uint32_t  HCD_GetCurrentSpeed      (USB_OTG_CORE_HANDLE *pdev);
-uint32_t  HCD_ResetPort            (USB_OTG_CORE_HANDLE *pdev);
+uint32_t  HCD_ResetPort            (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
 uint32_t  HCD_IsDeviceConnected    (USB_OTG_CORE_HANDLE *pdev);
 uint32_t  HCD_IsPortEnabled         (USB_OTG_CORE_HANDLE *pdev);
 
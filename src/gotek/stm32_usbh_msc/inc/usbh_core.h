@@ -29,6 +29,7 @@
 #define __USBH_CORE_H
 
 #include "usb_hcd.h"
+#include "usb_bsp.h"
 #include "usbh_def.h"
 #include "usbh_conf.h"
 
@@ -67,8 +68,11 @@ typedef enum {
 /* Following states are used for gState */
 typedef enum {
     HOST_IDLE =0,
+    HOST_DEV_DEBOUNCE,
+    HOST_PORT_RESET,
     HOST_WAIT_PRT_ENABLED,
     HOST_DEV_ATTACHED,
+    HOST_DEV_RESET_DONE,
     HOST_DEV_DISCONNECTED,
     HOST_DETECT_DEVICE_SPEED,
     HOST_ENUMERATION,
@@ -195,6 +199,12 @@ typedef struct _Host_TypeDef
 
     USBH_Class_cb_TypeDef               *class_cb;
     USBH_Usr_cb_TypeDef  	              *usr_cb;
+
+    /* Non-blocking delays: the state machine is held off until the timer 
+     * fires, leaving the caller free to get on with other work. */
+    struct USB_OTG_BSP_Timer delay;
+    uint8_t               delay_pending;
+    HOST_State            gStateReset;  /* State to enter after port reset */
 } USBH_HOST, *pUSBH_HOST;
 
 
@@ -70,6 +70,8 @@ typedef struct _BOTXfer
     uint8_t BOTState;
     uint8_t BOTStateBkp;
     uint8_t* pRxTxBuff;
+    const DSEG* pSeg;        /* Scatter-gather list, replaces pRxTxBuff */
+    uint32_t SegSkip;        /* Bytes to skip at start of pSeg */
     uint16_t DataLength;
     uint8_t BOTXferErrorCount;
     uint8_t BOTXferStatus;
@@ -84,6 +84,11 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
                         uint8_t *,
                         uint32_t ,
                         uint32_t );
+uint8_t USBH_MSC_Read10SG(USB_OTG_CORE_HANDLE *pdev,
+                          const DSEG *,
+                          uint32_t ,
+                          uint32_t ,
+                          uint32_t );
 void USBH_MSC_StateMachine(USB_OTG_CORE_HANDLE *pdev);
 
 #endif  //__USBH_MSC_SCSI_H__
@@ -611,7 +611,9 @@ USB_OTG_STS USB_OTG_CoreInitHost(USB_OTG_CORE_HANDLE *pdev)
     {
         USB_OTG_InitFSLSPClkSel(pdev , HCFG_48_MHZ);
     }
-    USB_OTG_ResetPort(pdev);
+    /* Any attached device is reset by the host state machine when it is 
+     * detected: here we only make sure the port is not held in reset. */
+    USB_OTG_ResetPort(pdev, 0);
 
     hcfg.d32 = USB_OTG_READ_REG32(&pdev->regs.HREGS->HCFG);
     hcfg.b.fslssupp = 0;
@@ -804,23 +806,21 @@ uint32_t USB_OTG_ReadHostAllChannels_intr (USB_OTG_CORE_HANDLE *pdev)
 
 
 /**
- * @brief  USB_OTG_ResetPort : Reset Host Port
+ * @brief  USB_OTG_ResetPort : Assert or release Host Port reset
  * @param  pdev : Selected device
+ * @param  state : 1 to assert reset, 0 to release it
  * @retval status
  * @note : (1)The application must wait at least 10 ms (+ 10 ms security)
- *   before clearing the reset bit.
+ *   before clearing the reset bit. This is timed by the caller, which
+ *   must not busy-wait.
  */
-uint32_t USB_OTG_ResetPort(USB_OTG_CORE_HANDLE *pdev)
+uint32_t USB_OTG_ResetPort(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
 {
     USB_OTG_HPRT0_TypeDef  hprt0;
 
     hprt0.d32 = USB_OTG_ReadHPRT0(pdev);
-    hprt0.b.prtrst = 1;
+    hprt0.b.prtrst = state;
     USB_OTG_WRITE_REG32(pdev->regs.HPRT0, hprt0.d32);
-    USB_OTG_BSP_mDelay (100);                                /* See Note #1 */
-    hprt0.b.prtrst = 0;
-    USB_OTG_WRITE_REG32(pdev->regs.HPRT0, hprt0.d32);
-    USB_OTG_BSP_mDelay (20);
     return 1;
 }
 
@@ -83,11 +83,12 @@ uint32_t HCD_GetCurrentSpeed (USB_OTG_CORE_HANDLE *pdev)
 
 /**
  * @brief  HCD_ResetPort
- *         Issues the reset command to device
+ *         Asserts or releases the reset command to device
  * @param  pdev : Selected device
+ * @param  state : 1 to assert reset, 0 to release it
  * @retval Status
  */
-uint32_t HCD_ResetPort(USB_OTG_CORE_HANDLE *pdev)
+uint32_t HCD_ResetPort(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
 {
     /*
       Before starting to drive a USB reset, the application waits for the OTG
@@ -96,7 +97,7 @@ uint32_t HCD_ResetPort(USB_OTG_CORE_HANDLE *pdev)
       caused by the attachment of a pull-up resistor on DP (FS) or DM (LS).
     */
 
-    USB_OTG_ResetPort(pdev);
+    USB_OTG_ResetPort(pdev, state);
     return 0;
 }
 
@@ -182,6 +182,7 @@ USBH_Status USBH_DeInit(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
 
     phost->gState = HOST_IDLE;
     phost->gStateBkp = HOST_IDLE;
+    phost->delay_pending = 0;
     phost->EnumState = ENUM_IDLE;
     phost->RequestState = CMD_SEND;
 
@@ -196,9 +197,52 @@ USBH_Status USBH_DeInit(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
     return USBH_OK;
 }
 
+/**
+ * @brief  USBH_Delay
+ *         Hold off the host state machine without busy-waiting
+ * @param  phost: Host handle
+ * @param  ms: Delay in milliseconds
+ * @retval None
+ */
+static void USBH_Delay(USBH_HOST *phost, uint32_t ms)
+{
+    USB_OTG_BSP_InitTimer(&phost->delay, ms);
+    phost->delay_pending = 1;
+}
+
+/**
+ * @brief  USBH_StartPortReset
+ *         Assert port reset, to be released by the HOST_PORT_RESET state
+ * @param  next: State to enter once reset and recovery are complete
+ * @retval None
+ */
+static void USBH_StartPortReset(USB_OTG_CORE_HANDLE *pdev,
+                                USBH_HOST *phost, HOST_State next)
+{
+    HCD_ResetPort(pdev, 1);
+    phost->gState = HOST_PORT_RESET;
+    phost->gStateReset = next;
+    USBH_Delay(phost, 100);
+}
+
+/**
+ * @brief  USBH_PortResetting
+ *         Port-enable is lost while the port is reset, and regained
+ *         shortly after reset is released.
+ * @retval 1 if port-enable is not yet expected
+ */
+static int USBH_PortResetting(USBH_HOST *phost)
+{
+    return ((phost->gState == HOST_DEV_DEBOUNCE)
+            || (phost->gState == HOST_PORT_RESET)
+            || (phost->gState == HOST_WAIT_PRT_ENABLED)
+            || phost->delay_pending);
+}
+
 /**
  * @brief  USBH_Process
- *         USB Host core main state machine process
+ *         USB Host core main state machine process. Never busy-waits:
+ *         timed steps are scheduled with USBH_Delay().
  * @param  None
  * @retval None
  */
@@ -207,14 +251,25 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
     volatile USBH_Status status = USBH_FAIL;
 
     /* check for Host port events */
-    if (((HCD_IsDeviceConnected(pdev) == 0)|| (HCD_IsPortEnabled(pdev) == 0))&& (phost->gState != HOST_IDLE))
+    if (((HCD_IsDeviceConnected(pdev) == 0)
+         || ((HCD_IsPortEnabled(pdev) == 0) && !USBH_PortResetting(phost)))
+        && (phost->gState != HOST_IDLE))
     {
         if(phost->gState != HOST_DEV_DISCONNECTED)
         {
             phost->gState = HOST_DEV_DISCONNECTED;
+            phost->delay_pending = 0;
         }
     }
 
+    /* Scheduled delay still running? */
+    if (phost->delay_pending)
+    {
+        if (!USB_OTG_BSP_TimerFired(&phost->delay))
+            return;
+        phost->delay_pending = 0;
+    }
+
     switch (phost->gState)
     {
 
@@ -222,24 +277,32 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
 
         if (HCD_IsDeviceConnected(pdev))
         {
-            phost->gState = HOST_WAIT_PRT_ENABLED;
-
             /*wait denounce delay */
-            USB_OTG_BSP_mDelay(100);
+            phost->gState = HOST_DEV_DEBOUNCE;
+            USBH_Delay(phost, 100);
+        }
+        break;
 
-            /* Apply a port RESET */
-            HCD_ResetPort(pdev);
+    case HOST_DEV_DEBOUNCE:
+        /* Apply a port RESET */
+        USBH_StartPortReset(pdev, phost, HOST_WAIT_PRT_ENABLED);
+        break;
 
-            /* User RESET callback*/
-            phost->usr_cb->ResetDevice();
-        }
+    case HOST_PORT_RESET:
+        /* Release port reset and allow the device time to recover. */
+        HCD_ResetPort(pdev, 0);
+        phost->gState = phost->gStateReset;
+        USBH_Delay(phost, 20);
+
+        /* User RESET callback*/
+        phost->usr_cb->ResetDevice();
         break;
 
     case HOST_WAIT_PRT_ENABLED:
         if (pdev->host.PortEnabled == 1)
         {
             phost->gState = HOST_DEV_ATTACHED;
-            USB_OTG_BSP_mDelay(50);
+            USBH_Delay(phost, 50);
         }
         break;
 
@@ -250,32 +313,31 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
         phost->Control.hc_num_in = USBH_Alloc_Channel(pdev, 0x80);
 
         /* Reset USB Device */
-        if ( HCD_ResetPort(pdev) == 0)
-        {
-            phost->usr_cb->ResetDevice();
+        USBH_StartPortReset(pdev, phost, HOST_DEV_RESET_DONE);
+        break;
 
-            /* Host is Now ready to start the Enumeration */
-            phost->device_prop.speed = HCD_GetCurrentSpeed(pdev);
+    case HOST_DEV_RESET_DONE:
+        /* Host is Now ready to start the Enumeration */
+        phost->device_prop.speed = HCD_GetCurrentSpeed(pdev);
 
-            phost->gState = HOST_ENUMERATION;
-            phost->usr_cb->DeviceSpeedDetected(phost->device_prop.speed);
+        phost->gState = HOST_ENUMERATION;
+        phost->usr_cb->DeviceSpeedDetected(phost->device_prop.speed);
 
-            /* Open Control pipes */
-            USBH_Open_Channel (pdev,
-                               phost->Control.hc_num_in,
-                               phost->device_prop.address,
-                               phost->device_prop.speed,
-                               EP_TYPE_CTRL,
-                               phost->Control.ep0size);
+        /* Open Control pipes */
+        USBH_Open_Channel (pdev,
+                           phost->Control.hc_num_in,
+                           phost->device_prop.address,
+                           phost->device_prop.speed,
+                           EP_TYPE_CTRL,
+                           phost->Control.ep0size);
 
-            /* Open Control pipes */
-            USBH_Open_Channel (pdev,
-                               phost->Control.hc_num_out,
-                               phost->device_prop.address,
-                               phost->device_prop.speed,
-                               EP_TYPE_CTRL,
-                               phost->Control.ep0size);
-        }
+        /* Open Control pipes */
+        USBH_Open_Channel (pdev,
+                           phost->Control.hc_num_out,
+                           phost->device_prop.address,
+                           phost->device_prop.speed,
+                           EP_TYPE_CTRL,
+                           phost->Control.ep0size);
         break;
 
     case HOST_ENUMERATION:
@@ -365,6 +427,9 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
         /* Manage User disconnect operations*/
         phost->usr_cb->DeviceDisconnected();
 
+        /* Make sure the port is not left held in reset. */
+        HCD_ResetPort(pdev, 0);
+
         /* Re-Initialize Host for new Enumeration */
         USBH_DeInit(pdev, phost);
         phost->usr_cb->DeInit();
@@ -468,7 +533,7 @@ static USBH_Status USBH_HandleEnum(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
         /* set address */
         if ( USBH_SetAddress(pdev, phost, USBH_DEVICE_ADDRESS) == USBH_OK)
         {
-            USB_OTG_BSP_mDelay(2);
+            USBH_Delay(phost, 2);
             phost->device_prop.address = USBH_DEVICE_ADDRESS;
 
             /* user callback for device address assigned */
@@ -38,6 +38,9 @@ HostCSWPkt_TypeDef USBH_MSC_CSWData;
 static uint32_t BOTStallErrorCount;   /* Keeps count of STALL Error Cases*/
 static uint8_t xfer_error_count;
 
+/* Receive buffer for scatter-gather segments whose data is discarded. */
+static uint32_t seg_bin[64/4];
+
 USBH_BOTXfer_TypeDef USBH_MSC_BOTXferParam;
 
 /**
@@ -56,6 +59,8 @@ void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev )
         USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
     }
 
+    /* Drop any scatter-gather list left by a disconnect mid-command. */
+    USBH_MSC_BOTXferParam.pSeg = NULL;
     BOTStallErrorCount = 0;
     MSCErrorCount = 0;
 }
@@ -73,7 +78,11 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
     uint8_t xferDirection, index;
     static uint32_t remainingDataLength;
     static uint8_t *datapointer , *datapointer_prev;
+    static const DSEG *seg;
+    static uint32_t seg_skip, seg_left;
+    static uint8_t seg_discard;
     static uint8_t error_direction;
+    uint32_t len;
     static struct USB_OTG_BSP_Timer timer;
     USBH_Status status;
 
@@ -113,6 +122,15 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
                     datapointer = USBH_MSC_BOTXferParam.pRxTxBuff;
                     datapointer_prev = datapointer;
 
+                    /* Latch any scatter-gather list: it applies to this 
+                     * command only. Without one, the data stage is a single
+                     * segment at pRxTxBuff. */
+                    seg = USBH_MSC_BOTXferParam.pSeg;
+                    seg_skip = USBH_MSC_BOTXferParam.SegSkip;
+                    seg_left = seg ? 0 : remainingDataLength;
+                    seg_discard = 0;
+                    USBH_MSC_BOTXferParam.pSeg = NULL;
+
                     /* If there is Data Transfer Stage */
                     if (xferDirection == USB_D2H)
                     {
@@ -169,29 +187,43 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
                 USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_BOT_DATAIN_STATE;
                 USB_OTG_BSP_InitTimer(&timer, DATA_STAGE_TIMEOUT);
 
-                if(remainingDataLength > MSC_Machine.MSBulkInEpSize)
-                {
-                    USBH_BulkReceiveData (pdev,
-                                          datapointer,
-                                          MSC_Machine.MSBulkInEpSize ,
-                                          MSC_Machine.hc_num_in);
-
-                    remainingDataLength -= MSC_Machine.MSBulkInEpSize;
-                    datapointer = datapointer + MSC_Machine.MSBulkInEpSize;
-                }
-                else if ( remainingDataLength == 0)
+                if ( remainingDataLength == 0)
                 {
                     /* If value was 0, and successful transfer, then change the state */
                     USBH_MSC_BOTXferParam.BOTState = USBH_MSC_RECEIVE_CSW_STATE;
                 }
                 else
                 {
+                    if (seg_left == 0)
+                    {
+                        /* Scatter-gather: move to the next segment. Packets
+                         * are received straight into place. */
+                        while (seg_skip >= seg->len)
+                        {
+                            seg_skip -= seg->len;
+                            seg++;
+                        }
+                        seg_left = seg->len - seg_skip;
+                        seg_discard = (seg->buff == NULL);
+                        datapointer = seg_discard ? (uint8_t *)seg_bin
+                            : seg->buff + seg_skip;
+                        seg_skip = 0;
+                        seg++;
+                    }
+
+                    len = min_t(uint32_t, remainingDataLength,
+                                MSC_Machine.MSBulkInEpSize);
                     USBH_BulkReceiveData (pdev,
                                           datapointer,
-                                          remainingDataLength ,
+                                          len ,
                                           MSC_Machine.hc_num_in);
 
-                    remainingDataLength = 0; /* Reset this value and keep in same state */
+                    /* Reaching zero keeps us in same state until the final
+                     * packet is received. */
+                    remainingDataLength -= len;
+                    seg_left -= len;
+                    if (!seg_discard)
+                        datapointer = datapointer + len;
                 }
             }
             else if(URB_Status == URB_STALL)
@@ -496,6 +496,7 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
             USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
 
             USBH_MSC_BOTXferParam.pRxTxBuff = dataBuffer;
+            USBH_MSC_BOTXferParam.pSeg = NULL;
 
             for(index = CBW_CB_LENGTH - 1; index != 0; index--)
             {
@@ -559,4 +560,41 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
     return status;
 }
 
+/**
+ * @brief  USBH_MSC_Read10SG
+ *         Issue the read command to the device, scattering the data
+ *         directly across a list of buffer segments.
+ * @param  seg : Segment list. Segment lengths are multiples of the
+ *         bulk-in packet size. NULL segment buffers discard their data.
+ * @param  skip : Bytes of the segment list to skip before the data
+ * @param  address : Address from which the data will be read
+ * @param  nbOfbytes : NbOfbytes to be read
+ * @retval Status
+ */
+uint8_t USBH_MSC_Read10SG(USB_OTG_CORE_HANDLE *pdev,
+                          const DSEG *seg,
+                          uint32_t skip,
+                          uint32_t address,
+                          uint32_t nbOfbytes)
+{
+    uint8_t send = (USBH_MSC_BOTXferParam.CmdStateMachine == CMD_SEND_STATE);
+    uint8_t status = USBH_MSC_Read10(pdev, NULL, address, nbOfbytes);
+
+    if (status != USBH_MSC_BUSY)
+    {
+        /* Command is over, or never started: the list must not outlive it,
+         * in case the CBW failed before the BOT machine latched it. */
+        USBH_MSC_BOTXferParam.pSeg = NULL;
+        USBH_MSC_BOTXferParam.SegSkip = 0;
+    }
+    else if (send)
+    {
+        /* Set up with the CBW; latched when the CBW has been sent. */
+        USBH_MSC_BOTXferParam.pSeg = seg;
+        USBH_MSC_BOTXferParam.SegSkip = skip;
+    }
+
+    return status;
+}
+
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -65,6 +65,7 @@ static void USBH_USR_DeviceDescAvailable(void *DeviceDesc)
     printk("> %s\n", __FUNCTION__);
     printk(" VID : %04X\n", hs->idVendor);
     printk(" PID : %04X\n", hs->idProduct);
+    iostats_set_device(hs->idVendor, hs->idProduct);
 }
 
 static void USBH_USR_DeviceAddressAssigned(void)
@@ -94,6 +95,7 @@ static void USBH_USR_ManufacturerString(void *ManufacturerString)
 static void USBH_USR_ProductString(void *ProductString)
 {
     printk(" Product : %s\n", (char *)ProductString);
+    iostats_set_product(ProductString);
 }
 
 static void USBH_USR_SerialNumString(void *SerialNumString)
@@ -207,6 +209,7 @@ static DRESULT handle_usb_status(BYTE status)
 
 DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
 {
+    stk32_time_t t = stk32_now();
     BYTE status;
 
     if (pdrv || !count)
@@ -221,11 +224,38 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
         USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
     } while (status == USBH_MSC_BUSY);
 
+    iostats_read(t);
+
+    return handle_usb_status(status);
+}
+
+DRESULT disk_read_sg(BYTE pdrv, const DSEG *seg, UINT skip,
+                     DWORD sector, UINT count)
+{
+    stk32_time_t t = stk32_now();
+    BYTE status;
+
+    if (pdrv || !count)
+        return RES_PARERR;
+    if (dstatus & STA_NOINIT)
+        return RES_NOTRDY;
+
+    do {
+        if (!HCD_IsDeviceConnected(&USB_OTG_Core))
+            return handle_usb_status(USBH_MSC_FAIL);
+        status = USBH_MSC_Read10SG(
+            &USB_OTG_Core, seg, skip, sector, 512 * count);
+        USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
+    } while (status == USBH_MSC_BUSY);
+
+    iostats_read(t);
+
     return handle_usb_status(status);
 }
 
 DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
 {
+    stk32_time_t t = stk32_now();
     BYTE status;
 
     if (pdrv || !count)
@@ -243,6 +273,8 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
         USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
     } while (status == USBH_MSC_BUSY);
 
+    iostats_write(t);
+
     return handle_usb_status(status);
 }
 
@@ -12,7 +12,6 @@
 #define TRACKS_PER_DISK 160
 #define BYTES_PER_TRACK 11*512
 #define TRACKLEN_BC 100160 /* multiple of 32 */
-#define TICKS_PER_CELL ((sysclk_ms(DRIVE_MS_PER_REV) * 16u) / TRACKLEN_BC)
 
 /* Shift even/odd bits into MFM data-bit positions */
 #define even(x) ((x)>>1)
@@ -44,6 +43,7 @@ static bool_t adf_open(struct image *im)
         return FALSE;
 
     im->nr_tracks = TRACKS_PER_DISK;
+    im->bufs.write_data.len = BYTES_PER_TRACK;
 
     return TRUE;
 }
@@ -52,7 +52,7 @@ static bool_t adf_seek_track(
     struct image *im, uint16_t track, stk_time_t *start_pos)
 {
     struct image_buf *rd = &im->bufs.read_data;
-    uint32_t sector, sys_ticks = start_pos ? *start_pos : 0;
+    uint32_t bc, sector, sys_ticks = start_pos ? *start_pos : 0;
 
     /* TODO: Fake out unformatted tracks. */
     track = min_t(uint16_t, track, im->nr_tracks-1);
@@ -60,15 +60,15 @@ static bool_t adf_seek_track(
     im->adf.trk_off = track * BYTES_PER_TRACK;
     im->adf.trk_len = BYTES_PER_TRACK;
     im->adf.mfm_cons = 512;
-    im->tracklen_bc = TRACKLEN_BC;
+    image_set_tracklen_bc(im, TRACKLEN_BC);
     im->ticks_since_flux = 0;
     im->cur_track = track;
 
-    im->cur_bc = (sys_ticks * 16) / TICKS_PER_CELL;
-    im->cur_bc &= ~511;
-    if (im->cur_bc >= im->tracklen_bc)
-        im->cur_bc = 0;
-    im->cur_ticks = im->cur_bc * TICKS_PER_CELL;
+    bc = (sys_ticks * 16) / im->ticks_per_cell;
+    bc &= ~511;
+    if (bc >= im->tracklen_bc)
+        bc = 0;
+    image_set_cur_bc(im, bc);
 
     sys_ticks = im->cur_ticks / 16;
 
@@ -77,6 +77,15 @@ static bool_t adf_seek_track(
     rd->prod = rd->cons = 0;
 
     if (start_pos) {
+        /* Read through the track cache: ring offsets match track offsets, 
+         * and sectors already in RAM are not read again. */
+        if (im->cached_track != track) {
+            im->cached_track = track;
+            im->adf.sec_valid = 0;
+        }
+        rd->p = im->bufs.write_data.p;
+        rd->len = BYTES_PER_TRACK;
+        rd->prod = rd->cons = im->adf.trk_pos * 8;
         image_read_track(im);
         *start_pos = sys_ticks;
     }
@@ -84,18 +93,43 @@ static bool_t adf_seek_track(
     return FALSE;
 }
 
+/* Most sectors read from mass storage in one request. */
+#define ADF_READ_SECS 8
+
 static bool_t adf_read_track(struct image *im)
 {
-    const UINT nr = 512;
     struct image_buf *rd = &im->bufs.read_data;
     uint8_t *buf = rd->p;
-    unsigned int buflen = rd->len & ~511;
+    unsigned int sector, off, nr, max, buflen = rd->len & ~511;
+    DSEG seg[2];
 
     if ((uint32_t)(rd->prod - rd->cons) > (buflen-512)*8)
         return FALSE;
 
-    F_lseek(&im->fp, im->adf.trk_off + im->adf.trk_pos);
-    F_read(&im->fp, &buf[(rd->prod/8) % buflen], nr, NULL);
+    /* Cached sectors are already in place in the ring. */
+    sector = im->adf.trk_pos / 512;
+    nr = 512;
+    if (!(im->adf.sec_valid & (1u << sector))) {
+        /* Read a run of uncached sectors, as far as ring space and the end
+         * of the track allow, straight into the ring. */
+        max = min_t(unsigned int, ADF_READ_SECS,
+                    (buflen*8 - (rd->prod - rd->cons)) / (512*8));
+        max = min_t(unsigned int, max,
+                    (im->adf.trk_len - im->adf.trk_pos) / 512);
+        for (nr = 1; nr < max; nr++)
+            if (im->adf.sec_valid & (1u << (sector + nr)))
+                break;
+        nr *= 512;
+        /* The run may wrap the ring. */
+        off = (rd->prod/8) % buflen;
+        seg[0].buff = &buf[off];
+        seg[0].len = min_t(unsigned int, nr, buflen - off);
+        seg[1].buff = buf;
+        seg[1].len = nr - seg[0].len;
+        F_lseek(&im->fp, im->adf.trk_off + im->adf.trk_pos);
+        F_read_sg(&im->fp, seg, seg[1].len ? 2 : 1);
+        im->adf.sec_valid |= ((1u << (nr/512)) - 1) << sector;
+    }
     rd->prod += nr * 8;
     im->adf.trk_pos += nr;
     if (im->adf.trk_pos >= im->adf.trk_len)
@@ -106,7 +140,9 @@ static bool_t adf_read_track(struct image *im)
 
 static uint16_t adf_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
 {
-    uint32_t ticks = im->ticks_since_flux, ticks_per_cell = TICKS_PER_CELL;
+    uint32_t ticks = im->ticks_since_flux, cur_ticks = im->cur_ticks;
+    uint32_t ticks_per_cell = im->ticks_per_cell;
+    uint32_t acc = im->ticks_acc, rem = im->ticks_rem;
     uint32_t info, csum, i, x, y = 32, todo = nr, sector, sec_offset;
     struct image_buf *rd = &im->bufs.read_data;
 
@@ -117,10 +153,15 @@ static uint16_t adf_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
             x = im->adf.mfm[im->adf.mfm_cons/32] << y;
             im->adf.mfm_cons += 32 - y;
             im->cur_bc += 32 - y;
-            im->cur_ticks += (32 - y) * ticks_per_cell;
+            cur_ticks += (32 - y) * ticks_per_cell;
             while (y < 32) {
                 y++;
                 ticks += ticks_per_cell;
+                if ((acc += rem) >= TRACKLEN_BC) {
+                    acc -= TRACKLEN_BC;
+                    ticks++;
+                    cur_ticks++;
+                }
                 if ((int32_t)x < 0) {
                     *tbuf++ = (ticks >> 4) - 1;
                     ticks &= 15;
@@ -134,8 +175,8 @@ static uint16_t adf_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
         ASSERT(y == 32);
         if (im->cur_bc >= im->tracklen_bc) {
             ASSERT(im->cur_bc == im->tracklen_bc);
-            im->tracklen_ticks = im->cur_ticks;
-            im->cur_bc = im->cur_ticks = 0;
+            ASSERT(cur_ticks == im->tracklen_ticks);
+            im->cur_bc = cur_ticks = 0;
         }
 
         /* We need more MFM: ensure we have buffered data to convert. */
@@ -208,7 +249,8 @@ static uint16_t adf_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
 out:
     im->adf.mfm_cons -= 32 - y;
     im->cur_bc -= 32 - y;
-    im->cur_ticks -= (32 - y) * ticks_per_cell;
+    im->cur_ticks = cur_ticks - (32 - y) * ticks_per_cell;
+    im->ticks_acc = acc;
     im->ticks_since_flux = ticks;
     return nr - todo;
 }
@@ -258,9 +300,15 @@ static void adf_write_track(struct image *im, bool_t flush)
         csum = (buf[c++ % buflen] & 0x55555555) << 1;
         csum |= buf[c++ % buflen] & 0x55555555;
 
-        /* Data area. Decode to a write buffer and keep a running checksum. */
+        /* Data area. Decode into the track cache, in image-file layout, and
+         * keep a running checksum. */
+        if (im->cached_track != im->cur_track) {
+            im->cached_track = im->cur_track;
+            im->adf.sec_valid = 0;
+        }
+        im->adf.sec_valid &= ~(1u << sect);
         dsum = 0;
-        w = wrbuf;
+        w = wrbuf + sect*(512/4);
         for (i = dsum = 0; i < 128; i++) {
             uint32_t o = buf[(c + 128) % buflen] & 0x55555555;
             uint32_t e = buf[c++ % buflen] & 0x55555555;
@@ -278,10 +326,11 @@ static void adf_write_track(struct image *im, bool_t flush)
 
         /* All good: write out to mass storage. */
         t = stk_now();
-        printk("Write %u/%u... ", (uint8_t)(info>>16), sect);
+        trace(TRACE_DEFAULT, "Write %u/%u... ", (uint8_t)(info>>16), sect);
         F_lseek(&im->fp, im->adf.trk_off + sect*512);
-        F_write(&im->fp, wrbuf, 512, NULL);
-        printk("%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+        F_write(&im->fp, wrbuf + sect*(512/4), 512, NULL);
+        trace(TRACE_DEFAULT, "%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+        im->adf.sec_valid |= 1u << sect;
     }
 
     wr->cons = c * 32;
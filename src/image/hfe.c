@@ -63,6 +63,8 @@ struct track_header {
 static bool_t hfe_open(struct image *im)
 {
     struct disk_header dhdr;
+    struct track_header thdr;
+    uint32_t i, len = 0;
 
     F_read(&im->fp, &dhdr, sizeof(dhdr), NULL);
     if (strncmp(dhdr.sig, "HXCPICFE", sizeof(dhdr.sig))
@@ -72,6 +74,20 @@ static bool_t hfe_open(struct image *im)
     im->hfe.tlut_base = le16toh(dhdr.track_list_offset);
     im->nr_tracks = dhdr.nr_tracks * 2;
 
+    /* Cache the track LUT, so that seeks need not read it. Size the write 
+     * staging area to hold our largest cylinder, if it fits. Otherwise we 
+     * write a 256-byte block at a time. */
+    F_lseek(&im->fp, im->hfe.tlut_base*512);
+    for (i = 0; i < dhdr.nr_tracks; i++) {
+        F_read(&im->fp, &thdr, sizeof(thdr), NULL);
+        if (i < HFE_TLUT_CYLS) {
+            im->hfe.tlut[i].off = le16toh(thdr.offset);
+            im->hfe.tlut[i].len = le16toh(thdr.len);
+        }
+        len = max_t(uint32_t, len, (le16toh(thdr.len) + 511) & ~511);
+    }
+    im->bufs.write_data.len = (len <= im->bufs.data.len) ? len : 256;
+
     return TRUE;
 }
 
@@ -79,28 +95,31 @@ static bool_t hfe_seek_track(
     struct image *im, uint16_t track, stk_time_t *start_pos)
 {
     struct image_buf *rd = &im->bufs.read_data;
-    uint32_t sys_ticks = start_pos ? *start_pos : 0;
+    uint32_t bc, sys_ticks = start_pos ? *start_pos : 0;
     struct track_header thdr;
 
     /* TODO: Fake out unformatted tracks. */
     track = min_t(uint16_t, track, im->nr_tracks-1);
 
-    F_lseek(&im->fp, im->hfe.tlut_base*512 + (track/2)*4);
-    F_read(&im->fp, &thdr, sizeof(thdr), NULL);
-
-    im->hfe.trk_off = le16toh(thdr.offset);
-    im->hfe.trk_len = le16toh(thdr.len) / 2;
-    im->tracklen_bc = im->hfe.trk_len * 8;
-    im->hfe.ticks_per_cell = ((sysclk_ms(DRIVE_MS_PER_REV) * 16u)
-                              / im->tracklen_bc);
+    if (track/2 < HFE_TLUT_CYLS) {
+        im->hfe.trk_off = im->hfe.tlut[track/2].off;
+        im->hfe.trk_len = im->hfe.tlut[track/2].len / 2;
+    } else {
+        /* Beyond the cached LUT: fetch the entry from the image file. */
+        F_lseek(&im->fp, im->hfe.tlut_base*512 + (track/2)*4);
+        F_read(&im->fp, &thdr, sizeof(thdr), NULL);
+        im->hfe.trk_off = le16toh(thdr.offset);
+        im->hfe.trk_len = le16toh(thdr.len) / 2;
+    }
+    image_set_tracklen_bc(im, im->hfe.trk_len * 8);
     im->ticks_since_flux = 0;
     im->cur_track = track;
 
-    im->cur_bc = (sys_ticks * 16) / im->hfe.ticks_per_cell;
-    im->cur_bc &= ~7;
-    if (im->cur_bc >= im->tracklen_bc)
-        im->cur_bc = 0;
-    im->cur_ticks = im->cur_bc * im->hfe.ticks_per_cell;
+    bc = (sys_ticks * 16) / im->ticks_per_cell;
+    bc &= ~7;
+    if (bc >= im->tracklen_bc)
+        bc = 0;
+    image_set_cur_bc(im, bc);
 
     sys_ticks = im->cur_ticks / 16;
 
@@ -108,30 +127,70 @@ static bool_t hfe_seek_track(
     rd->prod = rd->cons = 0;
 
     if (start_pos) {
+        if (im->cached_track == track) {
+            /* Track data is in RAM: use it directly as our read ring. Ring
+             * offsets then match track offsets. */
+            rd->p = im->bufs.write_data.p;
+            rd->len = (im->hfe.trk_len + 255) & ~255;
+            rd->prod = rd->cons = im->hfe.trk_pos * 8;
+        } else if (((im->hfe.trk_len + 255) & ~255)
+                   <= im->bufs.write_data.len) {
+            /* Read through the track cache. It is valid once a full 
+             * revolution has been read. */
+            im->cached_track = ~0;
+            im->hfe.fill = 0;
+            rd->p = im->bufs.write_data.p;
+            rd->len = (im->hfe.trk_len + 255) & ~255;
+            rd->prod = rd->cons = im->hfe.trk_pos * 8;
+        } else {
+            /* The read ring will overwrite any cached track data. */
+            im->cached_track = ~0;
+            rd->p = im->bufs.data.p;
+            rd->len = im->bufs.data.len;
+        }
         image_read_track(im);
-        rd->cons = im->cur_bc & 2047;
+        rd->cons += im->cur_bc & 2047;
         *start_pos = sys_ticks;
     }
 
     return FALSE;
 }
 
+/* Most 512-byte blocks read from mass storage in one request. */
+#define HFE_READ_BLKS 8
+
 static bool_t hfe_read_track(struct image *im)
 {
-    const UINT nr = 256;
     struct image_buf *rd = &im->bufs.read_data;
     uint8_t *buf = rd->p;
-    unsigned int buflen = rd->len & ~511;
+    unsigned int i, nr, side = im->cur_track & 1, buflen = rd->len & ~255;
+    DSEG seg[2*HFE_READ_BLKS];
 
     if ((uint32_t)(rd->prod - rd->cons) > (buflen-256)*8)
         return FALSE;
 
-    F_lseek(&im->fp,
-            im->hfe.trk_off * 512
-            + (im->cur_track & 1) * 256
-            + ((im->hfe.trk_pos & ~255) << 1)
-            + (im->hfe.trk_pos & 255));
-    F_read(&im->fp, &buf[(rd->prod/8) % buflen], nr, NULL);
+    /* A cached track is already in place in the ring. */
+    nr = 256;
+    if (im->cached_track != im->cur_track) {
+        /* Each 512-byte block interleaves 256 bytes of each side. Read a 
+         * run of whole blocks, landing our side's halves in the ring and 
+         * discarding the rest. */
+        nr = min_t(unsigned int, HFE_READ_BLKS,
+                   (buflen*8 - (rd->prod - rd->cons)) / (256*8));
+        nr = min_t(unsigned int, nr,
+                   (((im->hfe.trk_len + 255) & ~255) - im->hfe.trk_pos) / 256);
+        for (i = 0; i < nr; i++) {
+            seg[2*i+side].buff = &buf[(rd->prod/8 + i*256) % buflen];
+            seg[2*i+!side].buff = NULL;
+            seg[2*i].len = seg[2*i+1].len = 256;
+        }
+        nr *= 256;
+        F_lseek(&im->fp, im->hfe.trk_off * 512 + (im->hfe.trk_pos << 1));
+        F_read_sg(&im->fp, seg, 2*nr/256);
+        if ((rd->p == im->bufs.write_data.p)
+            && ((im->hfe.fill += nr) >= im->hfe.trk_len))
+            im->cached_track = im->cur_track;
+    }
     rd->prod += nr * 8;
     im->hfe.trk_pos += nr;
     if (im->hfe.trk_pos >= im->hfe.trk_len)
@@ -143,18 +202,20 @@ static bool_t hfe_read_track(struct image *im)
 static uint16_t hfe_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
 {
     struct image_buf *rd = &im->bufs.read_data;
-    uint32_t ticks = im->ticks_since_flux;
-    uint32_t ticks_per_cell = im->hfe.ticks_per_cell;
+    uint32_t ticks = im->ticks_since_flux, cur_ticks = im->cur_ticks;
+    uint32_t ticks_per_cell = im->ticks_per_cell;
+    uint32_t acc = im->ticks_acc, rem = im->ticks_rem;
+    uint32_t tracklen_bc = im->tracklen_bc;
     uint32_t y = 8, todo = nr;
     uint8_t x, *buf = rd->p;
-    unsigned int buflen = rd->len & ~511;
+    unsigned int buflen = rd->len & ~255;
 
     while (rd->cons != rd->prod) {
         ASSERT(y == 8);
-        if (im->cur_bc >= im->tracklen_bc) {
-            ASSERT(im->cur_bc == im->tracklen_bc);
-            im->tracklen_ticks = im->cur_ticks;
-            im->cur_bc = im->cur_ticks = 0;
+        if (im->cur_bc >= tracklen_bc) {
+            ASSERT(im->cur_bc == tracklen_bc);
+            ASSERT(cur_ticks == im->tracklen_ticks);
+            im->cur_bc = cur_ticks = 0;
             /* Skip tail of current 256-byte block. */
             rd->cons = (rd->cons + 256*8-1) & ~(256*8-1);
             continue;
@@ -163,10 +224,15 @@ static uint16_t hfe_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
         x = buf[(rd->cons/8) % buflen] >> y;
         rd->cons += 8 - y;
         im->cur_bc += 8 - y;
-        im->cur_ticks += (8 - y) * ticks_per_cell;
+        cur_ticks += (8 - y) * ticks_per_cell;
         while (y < 8) {
             y++;
             ticks += ticks_per_cell;
+            if ((acc += rem) >= tracklen_bc) {
+                acc -= tracklen_bc;
+                ticks++;
+                cur_ticks++;
+            }
             if (x & 1) {
                 *tbuf++ = (ticks >> 4) - 1;
                 ticks &= 15;
@@ -180,19 +246,29 @@ static uint16_t hfe_rdata_flux(struct image *im, uint16_t *tbuf, uint16_t nr)
 out:
     rd->cons -= 8 - y;
     im->cur_bc -= 8 - y;
-    im->cur_ticks -= (8 - y) * ticks_per_cell;
+    im->cur_ticks = cur_ticks - (8 - y) * ticks_per_cell;
+    im->ticks_acc = acc;
     im->ticks_since_flux = ticks;
     return nr - todo;
 }
 
+/* Copy @nr bytes from offset @c of a ring, handling wrap. */
+static void ring_copy(uint8_t *dst, const uint8_t *ring, unsigned int ringlen,
+                      uint32_t c, unsigned int nr)
+{
+    unsigned int off = c % ringlen, n = min_t(unsigned int, nr, ringlen - off);
+    memcpy(dst, &ring[off], n);
+    memcpy(dst + n, ring, nr - n);
+}
+
 static void hfe_write_track(struct image *im, bool_t flush)
 {
     struct image_buf *wr = &im->bufs.write_mfm;
     uint8_t *buf = wr->p;
     unsigned int buflen = wr->len;
     uint8_t *w, *wrbuf = im->bufs.write_data.p;
-    uint32_t base = (im->write_start*(16/8)) / im->hfe.ticks_per_cell;
-    uint32_t i, c = wr->cons / 8, p = wr->prod / 8;
+    uint32_t base = (im->write_start*(16/8)) / im->ticks_per_cell;
+    uint32_t c = wr->cons / 8, p = wr->prod / 8;
     stk_time_t t;
 
     /* Even when we can buffer the whole track in memory, it still performs
@@ -201,6 +277,8 @@ static void hfe_write_track(struct image *im, bool_t flush)
     const bool_t write_whole_track = 0;
 
     if (!im->bufs.write_data.prod) {
+        /* The staging buffer is about to be overwritten. */
+        im->cached_track = ~0;
         /* How many bytes is the full track data? */
         im->bufs.write_data.prod = ((im->hfe.trk_len * 2) + 511) & ~511;
         if (im->bufs.write_data.prod > im->bufs.write_data.len) {
@@ -209,11 +287,11 @@ static void hfe_write_track(struct image *im, bool_t flush)
         } else {
             /* Whole track fits in our buffer! Stream it in immediately. */
             t = stk_now();
-            printk("Read whole track %u... ", im->cur_track);
+            trace(TRACE_DEFAULT, "Read whole track %u... ", im->cur_track);
             F_lseek(&im->fp, im->hfe.trk_off * 512);
             F_read(&im->fp, wrbuf, im->bufs.write_data.prod, NULL);
             F_lseek(&im->fp, im->hfe.trk_off * 512);
-            printk("%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+            trace(TRACE_DEFAULT, "%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
         }
     }
 
@@ -235,37 +313,38 @@ static void hfe_write_track(struct image *im, bool_t flush)
 
         if (im->bufs.write_data.prod == 256) {
 
-            /* Encode into a 256-byte area in our staging buffer. */
-            w = wrbuf;
-            for (i = 0; i < nr; i++)
-                *w++ = _rbit32(buf[c++ % buflen]) >> 24;
+            /* Copy into a 256-byte area in our staging buffer. */
+            ring_copy(wrbuf, buf, buflen, c, nr);
+            c += nr;
 
             /* Write it back to mass storage straight away. */
             t = stk_now();
-            printk("Write %u-%u (%u)... ", off, off+nr-1, nr);
+            trace(TRACE_DEFAULT, "Write %u-%u (%u)... ", off, off+nr-1, nr);
             F_lseek(&im->fp,
                     im->hfe.trk_off * 512
                     + (im->cur_track & 1) * 256
                     + ((off & ~255) << 1) + (off & 255));
             F_write(&im->fp, wrbuf, nr, NULL);
-            printk("%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+            trace(TRACE_DEFAULT, "%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
 
         } else {
 
-            /* Encode into the whole-track buffer for later write-out. */
+            /* Copy into the whole-track buffer for later write-out. */
             w = wrbuf
                 + (im->cur_track & 1) * 256
                 + ((off & ~255) << 1) + (off & 255);
-            for (i = 0; i < nr; i++)
-                *w++ = _rbit32(buf[c++ % buflen]) >> 24;
+            ring_copy(w, buf, buflen, c, nr);
+            c += nr;
 
             if (!write_whole_track) {
                 w = wrbuf + ((off & ~255) << 1);
                 t = stk_now();
-                printk("Write %u-%u (%u)... ", off, off+nr-1, nr);
+                trace(TRACE_DEFAULT, "Write %u-%u (%u)... ",
+                      off, off+nr-1, nr);
                 F_lseek(&im->fp, im->hfe.trk_off * 512 + ((off & ~255) << 1));
                 F_write(&im->fp, w, 512, NULL);
-                printk("%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+                trace(TRACE_DEFAULT, "%u us\n",
+                      stk_diff(t, stk_now()) / STK_MHZ);
             }
         }
     }
@@ -275,9 +354,20 @@ static void hfe_write_track(struct image *im, bool_t flush)
     if (flush && write_whole_track) {
         /* Whole track mode: flush dirty buffer in one go. */
         t = stk_now();
-        printk("Write whole track %u... ", im->cur_track);
+        trace(TRACE_DEFAULT, "Write whole track %u... ", im->cur_track);
         F_write(&im->fp, wrbuf, im->bufs.write_data.prod, NULL);
-        printk("%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+        trace(TRACE_DEFAULT, "%u us\n", stk_diff(t, stk_now()) / STK_MHZ);
+    }
+
+    if (flush && (im->bufs.write_data.prod != 256)) {
+        /* Whole track mode: the staging buffer now matches mass storage. 
+         * Gather the current side's blocks to the front of the buffer so 
+         * that a following read of this track is served from RAM. Blocks
+         * move only towards the front and never overlap their source. */
+        uint32_t off, side = (im->cur_track & 1) * 256;
+        for (off = (side ? 0 : 256); off < im->hfe.trk_len; off += 256)
+            memcpy(wrbuf + off, wrbuf + (off << 1) + side, 256);
+        im->cached_track = im->cur_track;
     }
 }
 
@@ -287,7 +377,8 @@ const struct image_handler hfe_image_handler = {
     .read_track = hfe_read_track,
     .rdata_flux = hfe_rdata_flux,
     .write_track = hfe_write_track,
-    .syncword = 0xffffffff
+    .syncword = 0xffffffff,
+    .write_lsb_first = TRUE
 };
 
 /*
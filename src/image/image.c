@@ -41,6 +41,7 @@ bool_t image_open(struct image *im, const struct v2_slot *slot)
     /* Reinitialise image structure, except for static buffers. */
     memset(im, 0, sizeof(*im));
     im->bufs = bufs;
+    im->cached_track = ~0;
 
     memcpy(ext, slot->type, 3);
     ext[3] = '\0';
@@ -57,8 +58,21 @@ bool_t image_open(struct image *im, const struct v2_slot *slot)
     if (im->handler->write_track != NULL)
         mode |= FA_WRITE;
     fatfs_from_slot(&im->fp, slot, mode);
-    
-    return im->handler->open(im);
+
+    if (!im->handler->open(im))
+        return FALSE;
+
+    /* The handler has sized its write staging area: D-A mode additionally 
+     * needs room for a track of 512-byte sectors. Place the staging area at 
+     * the top of the data buffer, leaving the space below it for write_mfm 
+     * to borrow during write bursts. */
+    im->bufs.write_data.len = max_t(uint32_t, im->bufs.write_data.len, 9*512);
+    im->bufs.write_data.len = min_t(uint32_t, im->bufs.write_data.len,
+                                    im->bufs.data.len);
+    im->bufs.write_data.p = (char *)im->bufs.data.p
+        + im->bufs.data.len - im->bufs.write_data.len;
+
+    return TRUE;
 }
 
 bool_t image_seek_track(
@@ -97,6 +111,66 @@ void image_write_track(struct image *im, bool_t flush)
     im->handler->write_track(im, flush);
 }
 
+bool_t image_track_cached(struct image *im, uint16_t track)
+{
+    if (im->cached_track != track)
+        return FALSE;
+    /* ADF images are cached a sector at a time. */
+    return ((im->handler != &adf_image_handler)
+            || (im->adf.sec_valid == (1u << 11) - 1));
+}
+
+/* Ticks per revolution. Ticks are 1/16 SYSCLK. */
+#define TICKS_PER_REV (sysclk_ms(DRIVE_MS_PER_REV) * 16u)
+
+/* Returns (a * b) / d, and (a * b) % d in *rem, by long division: we have 
+ * no 64-bit divide. Requires b < d < 2^31. */
+static uint32_t muldiv(uint32_t a, uint32_t b, uint32_t d, uint32_t *rem)
+{
+    uint32_t q = 0, r = 0;
+    int i;
+
+    for (i = 31; i >= 0; i--) {
+        q <<= 1;
+        r <<= 1;
+        if (r >= d) {
+            r -= d;
+            q++;
+        }
+        if ((a >> i) & 1) {
+            r += b;
+            if (r >= d) {
+                r -= d;
+                q++;
+            }
+        }
+    }
+
+    *rem = r;
+    return q;
+}
+
+void image_set_tracklen_bc(struct image *im, uint32_t tracklen_bc)
+{
+    /* Timing depends only on track length, which rarely changes between 
+     * tracks of an image. */
+    if (tracklen_bc != im->tracklen_bc) {
+        im->tracklen_bc = tracklen_bc;
+        im->ticks_per_cell = TICKS_PER_REV / tracklen_bc;
+        im->ticks_rem = TICKS_PER_REV % tracklen_bc;
+    }
+    im->tracklen_ticks = TICKS_PER_REV;
+    image_set_cur_bc(im, 0);
+}
+
+void image_set_cur_bc(struct image *im, uint32_t bc)
+{
+    /* Cells 0..bc-1 include (bc * ticks_rem) / tracklen_bc long cells. */
+    im->cur_bc = bc;
+    im->cur_ticks = bc * im->ticks_per_cell
+        + muldiv(bc, im->ticks_rem, im->tracklen_bc, &im->ticks_acc);
+}
+
 uint32_t image_ticks_since_index(struct image *im)
 {
     uint32_t ticks = im->cur_ticks - im->ticks_since_flux;
@@ -0,0 +1,189 @@
+/*
+ * mfm.c
+ * 
+ * IBM-MFM track templates. For a given geometry the fixed parts of an 
+ * IBM-format track (gaps, sync marks, and ID fields including their CRCs) 
+ * are precomputed as MFM, so that only sector data and its CRC need be 
+ * encoded at run time.
+ * 
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ * 
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+static const uint16_t mfmtab[] = {
+    0xaaaa, 0xaaa9, 0xaaa4, 0xaaa5, 0xaa92, 0xaa91, 0xaa94, 0xaa95, 
+    0xaa4a, 0xaa49, 0xaa44, 0xaa45, 0xaa52, 0xaa51, 0xaa54, 0xaa55, 
+    0xa92a, 0xa929, 0xa924, 0xa925, 0xa912, 0xa911, 0xa914, 0xa915, 
+    0xa94a, 0xa949, 0xa944, 0xa945, 0xa952, 0xa951, 0xa954, 0xa955, 
+    0xa4aa, 0xa4a9, 0xa4a4, 0xa4a5, 0xa492, 0xa491, 0xa494, 0xa495, 
+    0xa44a, 0xa449, 0xa444, 0xa445, 0xa452, 0xa451, 0xa454, 0xa455, 
+    0xa52a, 0xa529, 0xa524, 0xa525, 0xa512, 0xa511, 0xa514, 0xa515, 
+    0xa54a, 0xa549, 0xa544, 0xa545, 0xa552, 0xa551, 0xa554, 0xa555, 
+    0x92aa, 0x92a9, 0x92a4, 0x92a5, 0x9292, 0x9291, 0x9294, 0x9295, 
+    0x924a, 0x9249, 0x9244, 0x9245, 0x9252, 0x9251, 0x9254, 0x9255, 
+    0x912a, 0x9129, 0x9124, 0x9125, 0x9112, 0x9111, 0x9114, 0x9115, 
+    0x914a, 0x9149, 0x9144, 0x9145, 0x9152, 0x9151, 0x9154, 0x9155, 
+    0x94aa, 0x94a9, 0x94a4, 0x94a5, 0x9492, 0x9491, 0x9494, 0x9495, 
+    0x944a, 0x9449, 0x9444, 0x9445, 0x9452, 0x9451, 0x9454, 0x9455, 
+    0x952a, 0x9529, 0x9524, 0x9525, 0x9512, 0x9511, 0x9514, 0x9515, 
+    0x954a, 0x9549, 0x9544, 0x9545, 0x9552, 0x9551, 0x9554, 0x9555, 
+    0x4aaa, 0x4aa9, 0x4aa4, 0x4aa5, 0x4a92, 0x4a91, 0x4a94, 0x4a95, 
+    0x4a4a, 0x4a49, 0x4a44, 0x4a45, 0x4a52, 0x4a51, 0x4a54, 0x4a55, 
+    0x492a, 0x4929, 0x4924, 0x4925, 0x4912, 0x4911, 0x4914, 0x4915, 
+    0x494a, 0x4949, 0x4944, 0x4945, 0x4952, 0x4951, 0x4954, 0x4955, 
+    0x44aa, 0x44a9, 0x44a4, 0x44a5, 0x4492, 0x4491, 0x4494, 0x4495, 
+    0x444a, 0x4449, 0x4444, 0x4445, 0x4452, 0x4451, 0x4454, 0x4455, 
+    0x452a, 0x4529, 0x4524, 0x4525, 0x4512, 0x4511, 0x4514, 0x4515, 
+    0x454a, 0x4549, 0x4544, 0x4545, 0x4552, 0x4551, 0x4554, 0x4555, 
+    0x52aa, 0x52a9, 0x52a4, 0x52a5, 0x5292, 0x5291, 0x5294, 0x5295, 
+    0x524a, 0x5249, 0x5244, 0x5245, 0x5252, 0x5251, 0x5254, 0x5255, 
+    0x512a, 0x5129, 0x5124, 0x5125, 0x5112, 0x5111, 0x5114, 0x5115, 
+    0x514a, 0x5149, 0x5144, 0x5145, 0x5152, 0x5151, 0x5154, 0x5155, 
+    0x54aa, 0x54a9, 0x54a4, 0x54a5, 0x5492, 0x5491, 0x5494, 0x5495, 
+    0x544a, 0x5449, 0x5444, 0x5445, 0x5452, 0x5451, 0x5454, 0x5455, 
+    0x552a, 0x5529, 0x5524, 0x5525, 0x5512, 0x5511, 0x5514, 0x5515, 
+    0x554a, 0x5549, 0x5544, 0x5545, 0x5552, 0x5551, 0x5554, 0x5555
+};
+
+/* Raw MFM words. Each is encoded assuming the previous data bit is 0: the 
+ * leading clock bit is cleared at emit time if necessary. */
+#define MFM_GAP      0x9254 /* 0x4e */
+#define MFM_PRESYNC  0xaaaa /* 0x00 */
+#define MFM_SYNC     0x4489 /* 0xa1, missing clock */
+#define MFM_IAM_SYNC 0x5224 /* 0xc2, missing clock */
+
+/* Standard gap and pre-sync lengths, in bytes. */
+#define GAP_4A  80
+#define GAP_1   50
+#define GAP_2   22
+#define PRESYNC 12
+
+/* Template chunk lengths, in MFM words. */
+#define CHUNK_START (GAP_4A + PRESYNC + 3 + 1 + GAP_1)
+#define CHUNK_IDAM  (PRESYNC + 3 + IBM_IDAM_LEN + GAP_2)
+#define chunk_dam(t) (PRESYNC + 3 + 1 + (128u << (t)->no) + 2 + (t)->gap3)
+
+void ibm_track_init(struct ibm_track *t, uint32_t tracklen_bc,
+                    uint8_t cyl, uint8_t hd, uint8_t sec_base,
+                    uint8_t nr_secs, uint8_t no, uint8_t gap3)
+{
+    const uint8_t dam[4] = { 0xa1, 0xa1, 0xa1, 0xfb };
+    uint8_t idam[10] = { 0xa1, 0xa1, 0xa1, 0xfe, cyl, hd, 0, no };
+    unsigned int i, j, len;
+    uint16_t crc, pr, w;
+
+    ASSERT(nr_secs <= IBM_MAX_SECS);
+    t->nr_secs = nr_secs;
+    t->no = no;
+    t->gap3 = gap3;
+    t->pos = 0;
+    t->pr = 0;
+    t->dam_crc = crc16_ccitt(dam, sizeof(dam), 0xffff);
+
+    /* ID fields, from the mark byte through the CRC. These follow a sync 
+     * word, whose last data bit is 1. */
+    for (i = 0; i < nr_secs; i++) {
+        idam[6] = sec_base + i;
+        crc = crc16_ccitt(idam, 8, 0xffff);
+        idam[8] = crc >> 8;
+        idam[9] = crc;
+        pr = MFM_SYNC;
+        for (j = 0; j < IBM_IDAM_LEN; j++) {
+            w = mfmtab[idam[3+j]];
+            t->idam[i][j] = pr = w & ~(pr << 15);
+        }
+    }
+
+    /* Gap 4 pads the track out to the requested length. */
+    len = CHUNK_START + nr_secs * (CHUNK_IDAM + chunk_dam(t));
+    ASSERT(len <= tracklen_bc/16);
+    t->gap4 = (len < tracklen_bc/16) ? tracklen_bc/16 - len : 0;
+
+    t->max_chunk = max_t(unsigned int, CHUNK_START, chunk_dam(t));
+    t->max_chunk = max_t(unsigned int, t->max_chunk, t->gap4);
+}
+
+bool_t ibm_track_emit(struct ibm_track *t, struct image_buf *mfm,
+                      const uint8_t *data)
+{
+    uint16_t *mfmb = mfm->p;
+    unsigned int i, mfmlen, mfmp, mfmc, sec_sz = 128u << t->no;
+    uint16_t pr = t->pr, crc, w;
+    const uint16_t *idam;
+    const uint8_t *p;
+
+    mfmp = mfm->prod / 16; /* MFM words */
+    mfmc = mfm->cons / 16; /* MFM words */
+    mfmlen = mfm->len / 2; /* MFM words */
+    if ((mfmlen - (mfmp - mfmc)) < t->max_chunk)
+        return FALSE;
+
+#define emit_raw(r) ({                                  \
+    uint16_t _r = (r);                                  \
+    mfmb[mfmp++ % mfmlen] = htobe16(_r & ~(pr << 15));  \
+    pr = _r; })
+#define emit_byte(b) emit_raw(mfmtab[(uint8_t)(b)])
+/* A run of a repeated word needs its clock bit fixing only at the start. */
+#define emit_fill(r, n) do {                            \
+    if ((n) == 0)                                       \
+        break;                                          \
+    emit_raw(r);                                        \
+    w = htobe16((r) & ~((r) << 15));                    \
+    for (i = 1; i < (n); i++)                           \
+        mfmb[mfmp++ % mfmlen] = w;                      \
+} while (0)
+
+    if (t->pos == 0) {
+        /* IAM */
+        emit_fill(MFM_GAP, GAP_4A);
+        emit_fill(MFM_PRESYNC, PRESYNC);
+        emit_fill(MFM_IAM_SYNC, 3);
+        emit_byte(0xfc);
+        emit_fill(MFM_GAP, GAP_1);
+    } else if (t->pos > 2*t->nr_secs) {
+        /* Track gap. */
+        emit_fill(MFM_GAP, t->gap4);
+    } else if (t->pos & 1) {
+        /* IDAM */
+        idam = t->idam[(t->pos-1) >> 1];
+        emit_fill(MFM_PRESYNC, PRESYNC);
+        emit_fill(MFM_SYNC, 3);
+        for (i = 0; i < IBM_IDAM_LEN; i++)
+            emit_raw(idam[i]);
+        emit_fill(MFM_GAP, GAP_2);
+    } else {
+        /* DAM */
+        p = &data[((t->pos-1) >> 1) * sec_sz];
+        emit_fill(MFM_PRESYNC, PRESYNC);
+        emit_fill(MFM_SYNC, 3);
+        emit_byte(0xfb);
+        for (i = 0; i < sec_sz; i++)
+            emit_byte(p[i]);
+        crc = crc16_ccitt(p, sec_sz, t->dam_crc);
+        emit_byte(crc >> 8);
+        emit_byte(crc);
+        emit_fill(MFM_GAP, t->gap3);
+    }
+
+#undef emit_fill
+#undef emit_byte
+#undef emit_raw
+
+    t->pos = (t->pos > 2*t->nr_secs) ? 0 : t->pos + 1;
+    t->pr = pr;
+    mfm->prod = mfmp * 16;
+
+    return TRUE;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
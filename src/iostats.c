@@ -0,0 +1,359 @@
+/*
+ * iostats.c
+ * 
+ * Mass-storage I/O statistics, kept on the mass-storage device itself.
+ * 
+ * Latency histograms use the same buckets as doc/timings.txt. The first line
+ * of the statistics file holds the raw counters, so that they accumulate 
+ * across sessions. The rest of the file is a human-readable summary, which 
+ * also includes this session's host-visible latencies.
+ * 
+ * Written & released by Keir Fraser <keir.xen@gmail.com>
+ * 
+ * This is free and unencumbered software released into the public domain.
+ * See the file COPYING for more details, or visit <http://unlicense.org>.
+ */
+
+#define IOSTATS_FILE "FFSTATS.TXT"
+#define IOSTATS_TAG  "#FFS1"
+
+/* 0-9ms, 10-19ms, ..., 90-99ms, 100-199ms, 200-299ms, >=300ms */
+#define NR_BUCKETS 13
+
+struct iolat {
+    uint32_t nr, min_us, max_us;
+    uint32_t histo[NR_BUCKETS];
+};
+
+/* Counters, all 32-bit so that they serialise as a simple array. */
+struct counters {
+    struct iolat read, write;
+    uint32_t deadline_misses;
+    uint32_t write_overruns;
+};
+
+/* Host-visible latency, this session only: <256us, 256-511us, ..., 
+ * 512-1023ms, >=1024ms (powers of two, in microseconds). */
+#define NR_LAT_BINS 14
+
+struct hostlat {
+    uint32_t nr, max_us;
+    uint32_t histo[NR_LAT_BINS];
+};
+
+static struct {
+    uint16_t vid, pid;
+    char product[32];
+    bool_t merged; /* counters include those loaded from the stats file */
+    bool_t dirty;
+    bool_t no_save; /* stats file could not be written: stop trying */
+    struct counters c;
+    struct hostlat lat[IOLAT_NR];
+} iostats;
+
+static const char *const lat_names[IOLAT_NR] = {
+    "Step to flux", "Side to flux", "WGATE to capture", "Track read",
+    "Swap to flux"
+};
+
+void iostats_set_device(uint16_t vid, uint16_t pid)
+{
+    memset(&iostats, 0, sizeof(iostats));
+    iostats.vid = vid;
+    iostats.pid = pid;
+}
+
+void iostats_set_product(const char *product)
+{
+    snprintf(iostats.product, sizeof(iostats.product), "%s", product);
+}
+
+static void record(struct iolat *l, stk32_time_t start)
+{
+    uint32_t us = stk32_diff(start, stk32_now()) / STK_MHZ;
+    uint32_t ms = us / 1000;
+
+    if (!l->nr || (us < l->min_us))
+        l->min_us = us;
+    l->max_us = max(l->max_us, us);
+    l->nr++;
+    l->histo[(ms < 100) ? ms / 10 : min_t(uint32_t, 9 + ms / 100,
+                                          NR_BUCKETS - 1)]++;
+    iostats.dirty = TRUE;
+}
+
+void iostats_read(stk32_time_t start)
+{
+    record(&iostats.c.read, start);
+}
+
+void iostats_write(stk32_time_t start)
+{
+    record(&iostats.c.write, start);
+}
+
+void iostats_deadline_miss(void)
+{
+    iostats.c.deadline_misses++;
+    iostats.dirty = TRUE;
+}
+
+void iostats_write_overruns(uint32_t nr)
+{
+    if (!nr)
+        return;
+    iostats.c.write_overruns += nr;
+    iostats.dirty = TRUE;
+}
+
+void iostats_latency(unsigned int type, uint32_t us)
+{
+    struct hostlat *l = &iostats.lat[type];
+
+    l->nr++;
+    l->max_us = max(l->max_us, us);
+    l->histo[(us < 256) ? 0 : min_t(unsigned int, 24 - __builtin_clz(us),
+                                    NR_LAT_BINS - 1)]++;
+    iostats.dirty = TRUE;
+}
+
+static bool_t parse_hex(const char *p, uint32_t *px)
+{
+    uint32_t x = 0;
+    unsigned int i;
+    char c;
+
+    for (i = 0; i < 8; i++) {
+        c = tolower(*p++);
+        if ((c >= '0') && (c <= '9'))
+            x = (x << 4) | (c - '0');
+        else if ((c >= 'a') && (c <= 'f'))
+            x = (x << 4) | (c - 'a' + 10);
+        else
+            return FALSE;
+    }
+
+    *px = x;
+    return TRUE;
+}
+
+/* Add counters from a previous session's statistics file into ours. */
+static void merge(FIL *fp)
+{
+    struct counters old;
+    uint32_t *p = (uint32_t *)&old, key;
+    char buf[10];
+    unsigned int i;
+    UINT nr;
+
+    /* Raw FatFs calls throughout: a bad or missing stats file must not 
+     * cancel the caller's filesystem session. */
+    if (f_open(fp, IOSTATS_FILE, FA_READ) != FR_OK)
+        return;
+
+    /* Tag and device key, then each counter, as " %08x". */
+    if ((f_read(fp, buf, sizeof(IOSTATS_TAG)-1, &nr) != FR_OK)
+        || (nr != sizeof(IOSTATS_TAG)-1)
+        || strncmp(buf, IOSTATS_TAG, sizeof(IOSTATS_TAG)-1))
+        goto out;
+    for (i = 0; i <= sizeof(old)/4; i++) {
+        if ((f_read(fp, buf, 9, &nr) != FR_OK)
+            || (nr != 9) || (buf[0] != ' ') || !parse_hex(&buf[1], p))
+            goto out;
+        if (i == 0) {
+            key = *p;
+            if (key != (((uint32_t)iostats.vid << 16) | iostats.pid))
+                goto out;
+        } else {
+            p++;
+        }
+    }
+
+    /* Loaded successfully: merge. */
+    for (i = 0; i < 2; i++) {
+        struct iolat *l = i ? &iostats.c.write : &iostats.c.read;
+        struct iolat *o = i ? &old.write : &old.read;
+        unsigned int j;
+        if (o->nr && (!l->nr || (o->min_us < l->min_us)))
+            l->min_us = o->min_us;
+        l->max_us = max(l->max_us, o->max_us);
+        l->nr += o->nr;
+        for (j = 0; j < NR_BUCKETS; j++)
+            l->histo[j] += o->histo[j];
+    }
+    iostats.c.deadline_misses += old.deadline_misses;
+    iostats.c.write_overruns += old.write_overruns;
+
+out:
+    f_close(fp);
+}
+
+/* First error while writing the stats file. Later lines are skipped. */
+static FRESULT write_fr;
+
+static void write_line(FIL *fp, const char *format, ...)
+{
+    char line[64];
+    va_list ap;
+    UINT bw;
+    int n;
+
+    if (write_fr != FR_OK)
+        return;
+
+    va_start(ap, format);
+    n = vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    n = min_t(int, n, sizeof(line)-1);
+
+    write_fr = f_write(fp, line, n, &bw);
+    if ((write_fr == FR_OK) && (bw < n))
+        write_fr = FR_DISK_FULL;
+}
+
+static void write_iolat(FIL *fp, const char *name, struct iolat *l)
+{
+    static const uint16_t lo[NR_BUCKETS] = {
+        0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 200, 300 };
+    uint32_t i, over50 = 0, nr = l->nr;
+
+    write_line(fp, "%s: %u\n", name, l->nr);
+    if (!nr)
+        return;
+    write_line(fp, "  Min: %uus Max: %uus\n", l->min_us, l->max_us);
+    write_line(fp, "  Histo:");
+    for (i = 0; i < NR_BUCKETS; i++) {
+        if (!l->histo[i])
+            continue;
+        if (i == NR_BUCKETS-1)
+            write_line(fp, " >=%ums:%u", lo[i], l->histo[i]);
+        else
+            write_line(fp, " %u-%ums:%u", lo[i],
+                       lo[i+1]-1, l->histo[i]);
+        if (lo[i] >= 50)
+            over50 += l->histo[i];
+    }
+    /* Percentage to two decimal places, avoiding 32-bit overflow. */
+    while (over50 > 400000) {
+        over50 >>= 1;
+        nr >>= 1;
+    }
+    over50 = (over50 * 10000) / nr;
+    write_line(fp, " >50ms: %u.%02u%%\n", over50 / 100, over50 % 100);
+}
+
+static void write_hostlat(FIL *fp, const char *name, struct hostlat *l)
+{
+    uint32_t i;
+
+    write_line(fp, "%s: %u\n", name, l->nr);
+    if (!l->nr)
+        return;
+    write_line(fp, "  Max: %uus\n", l->max_us);
+    write_line(fp, "  Histo:");
+    for (i = 0; i < NR_LAT_BINS; i++) {
+        if (!l->histo[i])
+            continue;
+        if (i == 0)
+            write_line(fp, " <256us:%u", l->histo[i]);
+        else if (i == NR_LAT_BINS-1)
+            write_line(fp, " >=%uus:%u", 128u << i, l->histo[i]);
+        else
+            write_line(fp, " %u-%uus:%u", 128u << i,
+                       (256u << i) - 1, l->histo[i]);
+    }
+    write_line(fp, "\n");
+}
+
+void iostats_save(FIL *fp)
+{
+    uint32_t *p = (uint32_t *)&iostats.c;
+    unsigned int i;
+
+    FRESULT fr;
+
+    if (!iostats.dirty || iostats.no_save)
+        return;
+
+    if (!iostats.merged) {
+        merge(fp);
+        iostats.merged = TRUE;
+    }
+
+    /* Quietly give up on write-protected or full media, for the rest of 
+     * this session. Errors are not passed on: they would cancel the 
+     * caller's filesystem session. */
+    if (f_open(fp, IOSTATS_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        iostats.no_save = TRUE;
+        return;
+    }
+    write_fr = FR_OK;
+
+    write_line(fp, IOSTATS_TAG " %04x%04x", iostats.vid, iostats.pid);
+    for (i = 0; i < sizeof(iostats.c)/4; i++)
+        write_line(fp, " %08x", p[i]);
+    write_line(fp, "\n");
+
+    write_line(fp, "FlashFloppy I/O statistics\n");
+    write_line(fp, "Device: %04x:%04x \"%s\"\n",
+               iostats.vid, iostats.pid, iostats.product);
+    write_iolat(fp, "Reads", &iostats.c.read);
+    write_iolat(fp, "Writes", &iostats.c.write);
+    write_line(fp, "Seek-to-flux deadline misses: %u\n",
+               iostats.c.deadline_misses);
+    write_line(fp, "Write MFM overruns: %u\n", iostats.c.write_overruns);
+    write_line(fp, "This session:\n");
+    for (i = 0; i < IOLAT_NR; i++)
+        write_hostlat(fp, lat_names[i], &iostats.lat[i]);
+
+    fr = f_close(fp);
+    if ((write_fr != FR_OK) || (fr != FR_OK)) {
+        printk("Stats file not saved (%d,%d)\n", write_fr, fr);
+        iostats.no_save = TRUE;
+    }
+
+    iostats.dirty = FALSE;
+}
+
+#if !defined(NDEBUG) || defined(CONSOLE_CMDS)
+
+static void dump_iolat(const char *name, const struct iolat *l)
+{
+    unsigned int i;
+
+    printk("%s: %u, min %u us, max %u us\n ms:", name,
+           l->nr, l->min_us, l->max_us);
+    for (i = 0; i < NR_BUCKETS; i++)
+        printk(" %u", l->histo[i]);
+    printk("\n");
+}
+
+void iostats_dump(void)
+{
+    unsigned int i, j;
+
+    printk("Device %04x:%04x \"%s\"\n",
+           iostats.vid, iostats.pid, iostats.product);
+    dump_iolat("Reads", &iostats.c.read);
+    dump_iolat("Writes", &iostats.c.write);
+    for (i = 0; i < IOLAT_NR; i++) {
+        struct hostlat *l = &iostats.lat[i];
+        printk("%s: %u, max %u us\n log2(us/128):", lat_names[i],
+               l->nr, l->max_us);
+        for (j = 0; j < NR_LAT_BINS; j++)
+            printk(" %u", l->histo[j]);
+        printk("\n");
+    }
+}
+
+#endif /* !NDEBUG || CONSOLE_CMDS */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "Linux"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
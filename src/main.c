@@ -20,16 +20,58 @@ static struct {
 
 static struct {
     uint16_t slot_nr, max_slot_nr;
-    uint8_t slot_map[1000/8];
     uint8_t backlight_on_secs;
     uint16_t lcd_scroll_msec;
     struct v2_slot autoboot, hxcsdfe, slot;
+    uint8_t hxc_ver; /* CFG_hxc: HXCSDFE.CFG major version */
 } cfg;
 
 static uint8_t cfg_mode;
 #define CFG_none      0 /* Iterate through all images in root. */
 #define CFG_hxc       1 /* Operation based on HXCSDFE.CFG. */
 
+/* Valid-slot bitmap, paged in fixed windows from its source on demand. A 
+ * summary bitmap records which windows contain any valid slot, so that 
+ * searches skip empty windows without paging them in. */
+#define SLOTMAP_MAX_SLOTS 65536
+#define SLOTMAP_WIN_SLOTS 512
+#define SLOTMAP_NR_WINS   (SLOTMAP_MAX_SLOTS / SLOTMAP_WIN_SLOTS)
+/* Index mode numbers its images DSKA0000-DSKA9999. */
+#define SLOTMAP_INDEX_WINS ((10000 + SLOTMAP_WIN_SLOTS - 1) / SLOTMAP_WIN_SLOTS)
+static struct {
+    uint8_t src;
+#define SLOTMAP_all   0 /* All slots 0..max_slot_nr are valid */
+#define SLOTMAP_cfg   1 /* Bitmap in HXCSDFE.CFG (v2 slot mode) */
+#define SLOTMAP_index 2 /* DSKAxxxx.* files in root (index mode) */
+    uint8_t win_nr; /* Window held in win[], if win_valid */
+    bool_t win_valid;
+    uint32_t cfg_off; /* SLOTMAP_cfg: file offset of bitmap */
+    /* SLOTMAP_index: the stretch of the root directory holding each 
+     * window's images, as directory offsets. A window is paged in by 
+     * searching from its first image to just past its last. */
+    struct {
+        uint32_t first, end;
+    } dir[SLOTMAP_INDEX_WINS];
+    uint8_t win[SLOTMAP_WIN_SLOTS/8];
+    uint8_t summary[SLOTMAP_NR_WINS/8];
+} slot_map;
+
+/* Most-recently-inserted slots, most recent first. Flipping between a few 
+ * images need not rescan the directory or config file each time. */
+#define MRU_SLOTS 4
+static struct {
+    uint16_t slot_nr;
+    struct v2_slot slot;
+} mru[MRU_SLOTS];
+static uint8_t mru_nr;
+
+/* First slot of each initial-letter group of slot names, built while the 
+ * slot map is loaded. Group 0 holds names not starting with a letter; 
+ * groups 1-26 are A-Z. Lets the user jump between groups with no I/O. */
+#define PREFIX_GROUPS 27
+#define PREFIX_NONE   0xffff
+static uint16_t prefix_first[PREFIX_GROUPS];
+
 uint8_t board_id;
 
 #define IMAGE_SELECT_WAIT_SECS 2
@@ -236,6 +278,180 @@ static uint8_t cfg_init(void)
     return CFG_hxc;
 }
 
+/* Parse index-mode filename DSKAnnnn.ext. Returns -1 if not valid. */
+static int dska_index(FILINFO *fp)
+{
+    const char *p = fp->fname + 4; /* skip "DSKA" */
+    unsigned int i, idx = 0;
+
+    /* Skip directories. */
+    if (fp->fattrib & AM_DIR)
+        return -1;
+    /* Parse 4-digit index number. */
+    for (i = 0; i < 4; i++) {
+        if ((*p < '0') || (*p > '9'))
+            break;
+        idx *= 10;
+        idx += *p++ - '0';
+    }
+    /* Expect a 4-digit number followed by a period. */
+    if ((i != 4) || (*p++ != '.'))
+        return -1;
+    /* Expect 3-char extension followed by nul. */
+    for (i = 0; (i < 3) && *p; i++, p++)
+        continue;
+    if ((i != 3) || (*p != '\0'))
+        return -1;
+    /* A file type we support? */
+    if (!image_valid(fp))
+        return -1;
+
+    return idx;
+}
+
+static unsigned int prefix_group(char c)
+{
+    c = tolower(c);
+    return ((c >= 'a') && (c <= 'z')) ? c - 'a' + 1 : 0;
+}
+
+/* Slots must be added in ascending order: the first in each group wins. */
+static void prefix_reset(void)
+{
+    memset(prefix_first, 0xff, sizeof(prefix_first));
+}
+
+static void prefix_add(unsigned int slot_nr, char c)
+{
+    unsigned int g = prefix_group(c);
+    if (prefix_first[g] == PREFIX_NONE)
+        prefix_first[g] = slot_nr;
+}
+
+/* Group containing slot @i, assuming slots are sorted by name. Used when 
+ * the current slot's name is not to hand. */
+static unsigned int prefix_group_at(unsigned int i)
+{
+    unsigned int g, best = 0, best_nr = 0;
+    for (g = 0; g < PREFIX_GROUPS; g++) {
+        if ((prefix_first[g] != PREFIX_NONE) && (prefix_first[g] <= i)
+            && (prefix_first[g] >= best_nr)) {
+            best = g;
+            best_nr = prefix_first[g];
+        }
+    }
+    return best;
+}
+
+/* Next non-empty group after @g in the given direction, wrapping. Returns 
+ * @g itself if no other group is populated. */
+static unsigned int prefix_step(unsigned int g, bool_t fwd)
+{
+    unsigned int i;
+    for (i = 1; i < PREFIX_GROUPS; i++) {
+        unsigned int n = fwd ? (g + i) % PREFIX_GROUPS
+            : (g + PREFIX_GROUPS - i) % PREFIX_GROUPS;
+        if (prefix_first[n] != PREFIX_NONE)
+            return n;
+    }
+    return g;
+}
+
+static void slot_map_init(uint8_t src)
+{
+    slot_map.src = src;
+    slot_map.win_valid = FALSE;
+    memset(slot_map.summary, (src == SLOTMAP_all) ? 0xff : 0,
+           sizeof(slot_map.summary));
+}
+
+/* Note that window @w contains valid slots, found while building the 
+ * summary. */
+static void slot_map_summarise(unsigned int w)
+{
+    slot_map.summary[w/8] |= 0x80 >> (w&7);
+}
+
+static void slot_map_load(unsigned int w)
+{
+    unsigned int base = w * SLOTMAP_WIN_SLOTS;
+    int idx;
+
+    if (slot_map.win_valid && (slot_map.win_nr == w))
+        return;
+
+    switch (slot_map.src) {
+    case SLOTMAP_cfg:
+        fatfs_from_slot(&fs->file, &cfg.hxcsdfe, FA_READ);
+        F_lseek(&fs->file, slot_map.cfg_off + base/8);
+        F_read(&fs->file, slot_map.win, sizeof(slot_map.win), NULL);
+        F_close(&fs->file);
+        if (w == 0)
+            slot_map.win[0] |= 0x80; /* slot 0 always available */
+        break;
+    case SLOTMAP_index:
+        memset(slot_map.win, 0, sizeof(slot_map.win));
+        for (F_findfrom(&fs->dp, &fs->fp, "", "DSKA*.*",
+                        slot_map.dir[w].first);
+             fs->fp.fname[0] != '\0';
+             F_findnext(&fs->dp, &fs->fp)) {
+            idx = dska_index(&fs->fp) - base;
+            if ((idx >= 0) && (idx < SLOTMAP_WIN_SLOTS))
+                slot_map.win[idx/8] |= 0x80 >> (idx&7);
+            if (fs->dp.dptr >= slot_map.dir[w].end)
+                break;
+        }
+        F_closedir(&fs->dp);
+        break;
+    }
+
+    slot_map.win_nr = w;
+    slot_map.win_valid = TRUE;
+}
+
+static bool_t slot_valid(unsigned int i)
+{
+    unsigned int w = i / SLOTMAP_WIN_SLOTS;
+
+    if (i > cfg.max_slot_nr)
+        return FALSE;
+    if (slot_map.src == SLOTMAP_all)
+        return TRUE;
+    if (!(slot_map.summary[w/8] & (0x80 >> (w&7))))
+        return FALSE;
+    slot_map_load(w);
+    i %= SLOTMAP_WIN_SLOTS;
+    return !!(slot_map.win[i/8] & (0x80 >> (i&7)));
+}
+
+/* Find the next valid slot after @i, searching forward or backward and 
+ * wrapping at the ends. Empty windows and empty bitmap bytes are skipped 
+ * whole. There is always at least one valid slot. */
+static unsigned int slot_step(unsigned int i, bool_t fwd)
+{
+    unsigned int span;
+
+    for (;;) {
+        if (fwd)
+            i = (i >= cfg.max_slot_nr) ? 0 : i + 1;
+        else
+            i = (i == 0) ? cfg.max_slot_nr : i - 1;
+        if (slot_valid(i))
+            return i;
+        if (slot_map.src == SLOTMAP_all)
+            continue;
+        /* Skip the rest of an empty window, or of an empty bitmap byte. */
+        span = SLOTMAP_WIN_SLOTS;
+        if ((i <= cfg.max_slot_nr) && slot_map.win_valid
+            && (slot_map.win_nr == i / SLOTMAP_WIN_SLOTS))
+            span = (slot_map.win[(i % SLOTMAP_WIN_SLOTS) / 8] == 0) ? 8 : 1;
+        if (fwd)
+            i = min_t(unsigned int, i | (span - 1), cfg.max_slot_nr);
+        else
+            i &= ~(span - 1);
+    }
+}
+
 #define CFG_KEEP_SLOT_NR  0 /* Do not re-read slot number from config */
 #define CFG_READ_SLOT_NR  1 /* Read slot number afresh from config */
 #define CFG_WRITE_SLOT_NR 2 /* Write new slot number to config */
@@ -251,8 +467,9 @@ static void no_cfg_update(uint8_t slot_mode)
         cfg.backlight_on_secs = BACKLIGHT_ON_SECS;
         cfg.lcd_scroll_msec = LCD_SCROLL_MSEC;
 
-        /* Populate slot_map[]. */
-        memset(&cfg.slot_map, 0xff, sizeof(cfg.slot_map));
+        /* Every image is a slot. */
+        slot_map_init(SLOTMAP_all);
+        prefix_reset();
         cfg.slot_nr = cfg.max_slot_nr = 0;
         for (F_findfirst(&fs->dp, &fs->fp, "", "*.*");
              fs->fp.fname[0] != '\0';
@@ -260,7 +477,9 @@ static void no_cfg_update(uint8_t slot_mode)
             if (!image_valid(&fs->fp))
                 continue;
             /* All is fine, populate the 'slot'. */
-            cfg.max_slot_nr++;
+            prefix_add(cfg.max_slot_nr, fs->fp.fname[0]);
+            if (++cfg.max_slot_nr == SLOTMAP_MAX_SLOTS-1)
+                break;
         }
         F_closedir(&fs->dp);
         /* Adjust max_slot_nr. Must be at least one 'slot'. */
@@ -286,6 +505,56 @@ static void no_cfg_update(uint8_t slot_mode)
     F_close(&fs->file);
 }
 
+/* Read window @w of the v2 valid-slot bitmap from the open config file into 
+ * slot_map.win. Returns the number of slots, below @nr, in the window. */
+static unsigned int hxc_slot_map_read(unsigned int w, uint32_t nr)
+{
+    uint8_t *p = slot_map.win;
+    unsigned int n = min_t(uint32_t, nr - w*SLOTMAP_WIN_SLOTS,
+                           SLOTMAP_WIN_SLOTS);
+
+    F_lseek(&fs->file, slot_map.cfg_off + w*SLOTMAP_WIN_SLOTS/8);
+    F_read(&fs->file, p, (n+7)/8, NULL);
+    if (w == 0)
+        p[0] |= 0x80; /* slot 0 always available */
+    if (n & 7)
+        p[n/8] &= 0xff00 >> (n&7);
+    return n;
+}
+
+/* Build the prefix index from the first name character of each valid v2 
+ * slot. Slot records are read a sector at a time, as several share each 
+ * sector. Slot 0 (AUTOBOOT) is not a library image and is skipped. */
+static void hxc_prefix_build(const struct hxcsdfe_cfg *hxc_cfg, uint32_t nr)
+{
+    uint32_t rec_len = 64 * hxc_cfg->number_of_drive_per_slot;
+    uint32_t base = hxc_cfg->slots_position*512
+        + offsetof(struct v2_slot, name);
+    uint32_t off, sec, cur_sec = ~0u;
+    uint8_t *buf = arena_alloc(512); /* until the next arena_init() */
+    unsigned int w, k, n;
+
+    prefix_reset();
+    for (w = 0; w*SLOTMAP_WIN_SLOTS < nr; w++) {
+        if (!(slot_map.summary[w/8] & (0x80 >> (w&7))))
+            continue;
+        n = hxc_slot_map_read(w, nr);
+        for (k = (w == 0) ? 1 : 0; k < n; k++) {
+            unsigned int s = w*SLOTMAP_WIN_SLOTS + k;
+            if (!(slot_map.win[k/8] & (0x80 >> (k&7))))
+                continue;
+            off = base + s*rec_len;
+            sec = off / 512;
+            if (sec != cur_sec) {
+                F_lseek(&fs->file, sec*512);
+                F_read(&fs->file, buf, 512, NULL);
+                cur_sec = sec;
+            }
+            prefix_add(s, buf[off % 512]);
+        }
+    }
+}
+
 static void hxc_cfg_update(uint8_t slot_mode)
 {
     struct hxcsdfe_cfg hxc_cfg;
@@ -311,7 +580,8 @@ static void hxc_cfg_update(uint8_t slot_mode)
             cfg.lcd_scroll_msec = 60000u / hxc_cfg.lcd_scroll_speed;
     }
 
-    switch (hxc_cfg.signature[9]-'0') {
+    cfg.hxc_ver = hxc_cfg.signature[9]-'0';
+    switch (cfg.hxc_ver) {
 
     case 1: {
         struct v1_slot v1_slot;
@@ -330,7 +600,15 @@ static void hxc_cfg_update(uint8_t slot_mode)
         /* Slot mode: initialise slot map and current slot. */
         if (slot_mode == CFG_READ_SLOT_NR) {
             cfg.max_slot_nr = hxc_cfg.number_of_slot - 1;
-            memset(&cfg.slot_map, 0xff, sizeof(cfg.slot_map));
+            slot_map_init(SLOTMAP_all);
+            prefix_reset();
+            for (i = 1; i <= cfg.max_slot_nr; i++) {
+                char c;
+                F_lseek(&fs->file, 1024 + i*128
+                        + offsetof(struct v1_slot, longName));
+                F_read(&fs->file, &c, 1, NULL);
+                prefix_add(i, c);
+            }
         }
         /* Slot mode: read current slot file info. */
         if (cfg.slot_nr == 0) {
@@ -358,14 +636,28 @@ static void hxc_cfg_update(uint8_t slot_mode)
             break;
         /* Slot mode: initialise slot map and current slot. */
         if (slot_mode == CFG_READ_SLOT_NR) {
-            cfg.max_slot_nr = hxc_cfg.max_slot_number - 1;
-            F_lseek(&fs->file, hxc_cfg.slots_map_position*512);
-            F_read(&fs->file, &cfg.slot_map, sizeof(cfg.slot_map), NULL);
-            cfg.slot_map[0] |= 0x80; /* slot 0 always available */
-            /* Find true max_slot_nr: */
-            while (!(cfg.slot_map[cfg.max_slot_nr/8]
-                     & (0x80>>(cfg.max_slot_nr&7))))
-                cfg.max_slot_nr--;
+            uint32_t nr = min_t(uint32_t, hxc_cfg.max_slot_number,
+                                SLOTMAP_MAX_SLOTS);
+            /* Stream through the bitmap a window at a time, building the
+             * summary and finding the true max_slot_nr. */
+            slot_map_init(SLOTMAP_cfg);
+            slot_map.cfg_off = hxc_cfg.slots_map_position*512;
+            cfg.max_slot_nr = 0;
+            for (i = 0; i*SLOTMAP_WIN_SLOTS < nr; i++) {
+                uint8_t *p = slot_map.win;
+                unsigned int j, n = hxc_slot_map_read(i, nr);
+                for (j = 0; j < (n+7)/8; j++) {
+                    if (p[j] == 0)
+                        continue;
+                    slot_map_summarise(i);
+                    cfg.max_slot_nr = i*SLOTMAP_WIN_SLOTS + j*8
+                        + 7 - __builtin_ctz(p[j]);
+                }
+            }
+            /* The slot table is re-read only on mount and after direct 
+             * access, when the selector may have renamed or replaced 
+             * images in place: the names must be read again too. */
+            hxc_prefix_build(&hxc_cfg, nr);
         }
         /* Slot mode: read current slot file info. */
         if (cfg.slot_nr == 0) {
@@ -391,38 +683,29 @@ static void hxc_cfg_update(uint8_t slot_mode)
 
         char name[16];
 
-        /* Index mode: populate slot_map[]. */
+        /* Index mode: build the slot-map summary, and note where in the 
+         * directory each window's images lie. Windows are paged in by 
+         * searching just that part of the directory again. */
         if (slot_mode == CFG_READ_SLOT_NR) {
-            memset(&cfg.slot_map, 0, sizeof(cfg.slot_map));
+            uint32_t pos;
+            slot_map_init(SLOTMAP_index);
+            /* Index-mode images are all named DSKAnnnn: no letter groups. */
+            prefix_reset();
             cfg.max_slot_nr = 0;
-            for (F_findfirst(&fs->dp, &fs->fp, "", "DSKA*.*");
+            /* @pos: where the search for the current image began. */
+            for (F_findfirst(&fs->dp, &fs->fp, "", "DSKA*.*"), pos = 0;
                  fs->fp.fname[0] != '\0';
-                 F_findnext(&fs->dp, &fs->fp)) {
-                const char *p = fs->fp.fname + 4; /* skip "DSKA" */
-                unsigned int idx = 0;
-                /* Skip directories. */
-                if (fs->fp.fattrib & AM_DIR)
-                    continue;
-                /* Parse 4-digit index number. */
-                for (i = 0; i < 4; i++) {
-                    if ((*p < '0') || (*p > '9'))
-                        break;
-                    idx *= 10;
-                    idx += *p++ - '0';
-                }
-                /* Expect a 4-digit number range 0-999 followed by a period. */
-                if ((i != 4) || (*p++ != '.') || (idx > 999))
-                    continue;
-                /* Expect 3-char extension followed by nul. */
-                for (i = 0; (i < 3) && *p; i++, p++)
-                    continue;
-                if ((i != 3) || (*p != '\0'))
-                    continue;
-                /* A file type we support? */
-                if (!image_valid(&fs->fp))
+                 pos = fs->dp.dptr, F_findnext(&fs->dp, &fs->fp)) {
+                int idx = dska_index(&fs->fp);
+                unsigned int w;
+                if (idx < 0)
                     continue;
                 /* All is fine, populate the 'slot'. */
-                cfg.slot_map[idx/8] |= 0x80 >> (idx&7);
+                w = idx / SLOTMAP_WIN_SLOTS;
+                if (!(slot_map.summary[w/8] & (0x80 >> (w&7))))
+                    slot_map.dir[w].first = pos;
+                slot_map.dir[w].end = fs->dp.dptr;
+                slot_map_summarise(w);
                 cfg.max_slot_nr = max_t(
                     uint16_t, cfg.max_slot_nr, idx);
             }
@@ -444,8 +727,77 @@ static void hxc_cfg_update(uint8_t slot_mode)
         cfg.slot.type[i] = tolower(cfg.slot.type[i]);
 }
 
+/* Write just the current slot number back to HXCSDFE.CFG. */
+static void hxc_cfg_write_slot_nr(void)
+{
+    uint32_t slot_nr = cfg.slot_nr;
+
+    fatfs_from_slot(&fs->file, &cfg.hxcsdfe, FA_READ | FA_WRITE);
+    if (cfg.hxc_ver == 1) {
+        uint8_t slot_index = slot_nr;
+        F_lseek(&fs->file, offsetof(struct hxcsdfe_cfg, slot_index));
+        F_write(&fs->file, &slot_index, sizeof(slot_index), NULL);
+    } else {
+        F_lseek(&fs->file, offsetof(struct hxcsdfe_cfg, cur_slot_number));
+        F_write(&fs->file, &slot_nr, sizeof(slot_nr), NULL);
+    }
+    F_close(&fs->file);
+}
+
+static int mru_find(uint16_t slot_nr)
+{
+    int i;
+
+    for (i = 0; i < mru_nr; i++)
+        if (mru[i].slot_nr == slot_nr)
+            return i;
+    return -1;
+}
+
+static bool_t mru_lookup(uint16_t slot_nr)
+{
+    int i = mru_find(slot_nr);
+
+    if (i < 0)
+        return FALSE;
+    memcpy(&cfg.slot, &mru[i].slot, sizeof(cfg.slot));
+    return TRUE;
+}
+
+/* Remember the slot being inserted. Slots merely browsed are not added, so 
+ * that they do not push out the images actually in use. */
+static void mru_add(void)
+{
+    int i = mru_find(cfg.slot_nr);
+
+    if (i < 0) {
+        if (mru_nr < MRU_SLOTS)
+            mru_nr++;
+        i = mru_nr - 1;
+    }
+    memmove(&mru[1], &mru[0], i * sizeof(mru[0]));
+    mru[0].slot_nr = cfg.slot_nr;
+    memcpy(&mru[0].slot, &cfg.slot, sizeof(cfg.slot));
+}
+
 static void cfg_update(uint8_t slot_mode)
 {
+    stk_time_t t = stk_now();
+    bool_t hit = FALSE;
+
+    if (slot_mode == CFG_READ_SLOT_NR) {
+        /* Config may have changed under our feet: forget cached slots. The 
+         * prefix index is rebuilt below, where supported. */
+        mru_nr = 0;
+    } else if (mru_lookup(cfg.slot_nr)) {
+        /* Slot info is cached. HxC mode must still persist a new slot 
+         * number to the config file, but need write nothing else. */
+        hit = TRUE;
+        if ((slot_mode == CFG_WRITE_SLOT_NR) && (cfg_mode == CFG_hxc))
+            hxc_cfg_write_slot_nr();
+        goto out;
+    }
+
     switch (cfg_mode) {
     case CFG_none:
         no_cfg_update(slot_mode);
@@ -454,15 +806,23 @@ static void cfg_update(uint8_t slot_mode)
         hxc_cfg_update(slot_mode);
         break;
     }
+
+out:
+    trace(TRACE_DEFAULT, "Slot %u %s in %u us\n", cfg.slot_nr,
+          hit ? "cached" : "resolved", stk_diff(t, stk_now()) / STK_MHZ);
 }
 
-/* Based on button presses, change which floppy image is selected. */
+/* Based on button presses, change which floppy image is selected. Holding 
+ * one button until it auto-repeats and then pressing the other jumps between 
+ * initial-letter groups of slot names, in the held button's direction. */
 static void choose_new_image(uint8_t init_b)
 {
     char msg[4];
     uint8_t b, prev_b;
     stk_time_t last_change = 0;
     uint32_t i, changes = 0;
+    bool_t group_jump = FALSE, fwd = FALSE;
+    int grp = prefix_group(cfg.slot.name[0]); /* -1 if unknown */
 
     for (prev_b = 0, b = init_b; b != 0; prev_b = b, b = buttons) {
         if (prev_b == b) {
@@ -473,14 +833,32 @@ static void choose_new_image(uint8_t init_b)
             if (stk_diff(last_change, stk_now()) < delay)
                 continue;
             changes++;
+        } else if (group_jump) {
+            /* Chord released: resume stepping after the usual delay. */
+            group_jump = FALSE;
+            changes = 0;
+            last_change = stk_now();
+            continue;
         } else {
             /* Different button pressed. Takes immediate effect, resets 
-             * the continuous-press decaying delay. */
+             * the continuous-press decaying delay. A second button pressed 
+             * while the first is auto-repeating is a group-jump chord. */
+            if ((b == (B_LEFT|B_RIGHT)) && changes) {
+                group_jump = TRUE;
+                fwd = !!(prev_b & B_RIGHT);
+            }
             changes = 0;
         }
         last_change = stk_now();
         i = cfg.slot_nr;
-        if (!(b ^ (B_LEFT|B_RIGHT))) {
+        if (group_jump) {
+            unsigned int g = prefix_step(
+                (grp >= 0) ? grp : prefix_group_at(i), fwd);
+            if (prefix_first[g] != PREFIX_NONE) {
+                i = prefix_first[g];
+                grp = g;
+            }
+        } else if (!(b ^ (B_LEFT|B_RIGHT))) {
             i = cfg.slot_nr = 0;
             switch (display_mode) {
             case DM_LED_3DIG:
@@ -495,16 +873,13 @@ static void choose_new_image(uint8_t init_b)
             while ((stk_diff(last_change, stk_now()) < stk_ms(1000))
                    && buttons)
                 continue;
+            grp = -1;
         } else if (b & B_LEFT) {
-            do {
-                if (i-- == 0)
-                    i = cfg.max_slot_nr;
-            } while (!(cfg.slot_map[i/8] & (0x80>>(i&7))));
+            i = slot_step(i, FALSE);
+            grp = -1;
         } else { /* b & B_RIGHT */
-            do {
-                if (i++ >= cfg.max_slot_nr)
-                    i = 0;
-            } while (!(cfg.slot_map[i/8] & (0x80>>(i&7))));
+            i = slot_step(i, TRUE);
+            grp = -1;
         }
         cfg.slot_nr = i;
         switch (display_mode) {
@@ -515,21 +890,70 @@ static void choose_new_image(uint8_t init_b)
         case DM_LCD_1602:
             cfg_update(CFG_KEEP_SLOT_NR);
             lcd_write_slot();
+            grp = prefix_group(cfg.slot.name[0]);
             break;
         }
     }
 }
 
+#if !defined(NDEBUG) || defined(CONSOLE_CMDS)
+
+static void cmd_state(int argc, char *argv[])
+{
+    printk("Slot %u/%u: '%s'\n", cfg.slot_nr, cfg.max_slot_nr, cfg.slot.name);
+    floppy_dump_state();
+}
+
+static void cmd_bufs(int argc, char *argv[])
+{
+    floppy_dump_bufs();
+}
+
+static void cmd_stats(int argc, char *argv[])
+{
+    floppy_dump_stats();
+    iostats_dump();
+}
+
+#ifndef NDEBUG
+
+static void cmd_events(int argc, char *argv[])
+{
+    floppy_dump_events();
+}
+
+static void cmd_audit(int argc, char *argv[])
+{
+    if (argc > 1)
+        floppy_set_audit(!strcmp(argv[1], "on"));
+    printk("Flux audit %s\n", floppy_get_audit() ? "on" : "off");
+}
+
+#endif
+
+static const struct console_cmd console_cmds[] = {
+    { "state", "Current slot, track and drive state", cmd_state },
+    { "bufs", "Buffer occupancy", cmd_bufs },
+    { "stats", "Cache, timing and I/O counters", cmd_stats },
+#ifndef NDEBUG
+    { "events", "Recent host bus events and stream responses", cmd_events },
+    { "audit", "Per-revolution read flux check [on|off]", cmd_audit }
+#endif
+};
+
+#endif /* !NDEBUG || CONSOLE_CMDS */
+
 int floppy_main(void)
 {
     stk_time_t t_now, t_prev, t_diff;
     char msg[4];
     uint8_t b;
     uint32_t i;
+    bool_t swapping = FALSE;
 
     arena_init();
     fs = arena_alloc(sizeof(*fs));
-    
+
     cfg_mode = cfg_init();
     cfg_update(CFG_READ_SLOT_NR);
 
@@ -538,10 +962,8 @@ int floppy_main(void)
         /* Make sure slot index is on a valid slot. Find next valid slot if 
          * not (and update config). */
         i = cfg.slot_nr;
-        if (!(cfg.slot_map[i/8] & (0x80>>(i&7)))) {
-            while (!(cfg.slot_map[i/8] & (0x80>>(i&7))))
-                if (i++ >= cfg.max_slot_nr)
-                    i = 0;
+        if (!slot_valid(i)) {
+            i = slot_step(min_t(unsigned int, i, cfg.max_slot_nr), TRUE);
             printk("Updated slot %u -> %u\n", cfg.slot_nr, i);
             cfg.slot_nr = i;
             cfg_update(CFG_WRITE_SLOT_NR);
@@ -567,7 +989,11 @@ int floppy_main(void)
         printk("Attr: %02x Clus: %08x Size: %u\n",
                cfg.slot.attributes, cfg.slot.firstCluster, cfg.slot.size);
 
-        floppy_insert(0, &cfg.slot);
+        mru_add();
+        if (swapping)
+            floppy_reinsert(&cfg.slot);
+        else
+            floppy_insert(0, &cfg.slot);
 
         lcd_update_ticks = stk_ms(20);
         lcd_scroll_ticks = stk_ms(LCD_SCROLL_PAUSE_MSEC);
@@ -588,21 +1014,30 @@ int floppy_main(void)
                 lcd_scroll_name();
             }
             canary_check();
+            console_process();
             if (!usbh_msc_connected())
                 F_die();
             t_prev = t_now;
         }
 
-        floppy_cancel();
-        arena_init();
-        fs = arena_alloc(sizeof(*fs));
-
         /* No buttons pressed: re-read config and carry on. */
         if (b == 0) {
+            floppy_cancel();
+            arena_init();
+            fs = arena_alloc(sizeof(*fs));
+            /* Drive is idle: a good time to update the stats file. Not on 
+             * image swaps, which must be quick. */
+            iostats_save(&fs->file);
             cfg_update(CFG_READ_SLOT_NR);
+            swapping = FALSE;
             continue;
         }
 
+        /* Image change: keep the drive's buffers, DMA rings and timers, and 
+         * borrow its idle track-data buffer for our scratch space. */
+        fs = floppy_eject(sizeof(*fs));
+        swapping = TRUE;
+
         do {
             /* While buttons are pressed we poll them and update current image
              * accordingly. */
@@ -650,7 +1085,7 @@ int main(void)
     timers_init();
 
     console_init();
-    console_crash_on_input();
+    console_set_cmds(console_cmds, ARRAY_SIZE(console_cmds));
 
     /* Wait for 5v power to stabilise before initing external peripherals. */
     delay_ms(200);
@@ -661,14 +1096,19 @@ int main(void)
     printk("** Keir Fraser <keir.xen@gmail.com>\n");
     printk("** https://github.com/keirf/FlashFloppy\n\n");
 
+    /* Start USB first: enumeration never busy-waits, so device debounce, 
+     * reset and recovery delays elapse while we set up everything else. */
+    usbh_msc_init();
+    usbh_msc_process();
+
     speaker_init();
+    usbh_msc_process();
 
     floppy_init();
+    usbh_msc_process();
 
     display_init();
 
-    usbh_msc_init();
-
     cfg.backlight_on_secs = 0xff;
     timer_init(&button_timer, button_timer_fn, NULL);
     timer_set(&button_timer, stk_now());
@@ -72,9 +72,9 @@ static void exception_init(void)
                    SCB_SHCSR_BUSFAULTENA |
                    SCB_SHCSR_MEMFAULTENA);
 
-    /* SVCall/PendSV exceptions have lowest priority. */
+    /* SVCall/PendSV/SysTick exceptions have lowest priority. */
     scb->shpr2 = 0xff<<24;
-    scb->shpr3 = 0xff<<16;
+    scb->shpr3 = 0xffff<<16;
 }
 
 static void clock_init(void)
@@ -106,9 +106,9 @@ static void clock_init(void)
     /* Internal oscillator no longer needed. */
     rcc->cr &= ~RCC_CR_HSION;
 
-    /* Enable SysTick counter at 72/8=9MHz. */
+    /* Enable SysTick counter at 72/8=9MHz. Count wraps for stk32_now(). */
     stk->load = STK_MASK;
-    stk->ctrl = STK_CTRL_ENABLE;
+    stk->ctrl = STK_CTRL_ENABLE | STK_CTRL_TICKINT;
 }
 
 static void gpio_init(GPIO gpio)
@@ -148,6 +148,33 @@ void stm32_init(void)
     cpu_sync();
 }
 
+/* Number of times the SysTick counter has wrapped. */
+static volatile uint32_t stk_wraps;
+
+void EXC_systick(void) __attribute__((alias("EXC_stk_wrapped")));
+static void EXC_stk_wrapped(void)
+{
+    stk_wraps++;
+}
+
+stk32_time_t stk32_now(void)
+{
+    uint32_t wraps, val, pend;
+
+    do {
+        wraps = stk_wraps;
+        val = stk_now();
+        pend = scb->icsr & SCB_ICSR_PENDSTSET;
+    } while (wraps != stk_wraps);
+
+    /* The wrap exception may be held off by our caller's priority. If so, 
+     * and the counter has just reloaded, count the wrap ourselves. */
+    if (pend && (val > STK_MASK/2))
+        wraps++;
+
+    return (wraps << 24) + (STK_MASK - val);
+}
+
 void delay_ticks(unsigned int ticks)
 {
     unsigned int diff, cur, prev = stk->val;
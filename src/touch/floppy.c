@@ -52,7 +52,6 @@ void IRQ_11(void) __attribute__((alias("IRQ_wdata_dma")));
 void IRQ_17(void) __attribute__((alias("IRQ_rdata_dma")));
 
 /* Bind all EXTI IRQs */
-void IRQ_6(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI0 */
 void IRQ_7(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI1 */
 void IRQ_8(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI2 */
 void IRQ_9(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI3 */
@@ -60,7 +59,6 @@ void IRQ_10(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI4 */
 void IRQ_23(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI9_5 */
 void IRQ_40(void) __attribute__((alias("IRQ_input_changed"))); /* EXTI15_10 */
 static const struct exti_irq exti_irqs[] = {
-    {  6, FLOPPY_IRQ_HI_PRI, 0 }, 
     {  7, FLOPPY_IRQ_HI_PRI, 0 }, 
     {  8, FLOPPY_IRQ_HI_PRI, 0 }, 
     {  9, FLOPPY_IRQ_HI_PRI, 0 }, 
@@ -90,6 +88,8 @@ static uint8_t input_update_default(void)
 
 static void input_init_default(void)
 {
+    uint32_t mask;
+
     gpio_configure_pin(gpioa, 8+inp_sel0,  GPI_bus);
     gpio_configure_pin(gpioa, 8+inp_sel1,  GPI_bus);
     gpio_configure_pin(gpioa, 8+inp_dir,   GPI_bus);
@@ -97,12 +97,15 @@ static void input_init_default(void)
     gpio_configure_pin(gpioa, 8+inp_wgate, GPI_bus);
     gpio_configure_pin(gpioa, 8+inp_side,  GPI_bus);
 
-    /* PA[15:0] -> EXT[15:0] */
-    afio->exticr1 = afio->exticr2 = afio->exticr3 = afio->exticr4 = 0x0000;
+    /* PA[15:1] -> EXT[15:1]. EXT0 belongs to the touch panel. */
+    afio->exticr1 &= 0x000f;
+    afio->exticr2 = afio->exticr3 = afio->exticr4 = 0x0000;
 
-    exti->imr = exti->rtsr = exti->ftsr =
-        m(8+inp_step) | m(8+inp_sel0) | m(8+inp_sel1)
+    mask = m(8+inp_step) | m(8+inp_sel0) | m(8+inp_sel1)
         | m(8+inp_wgate) | m(8+inp_side);
+    exti->imr |= mask;
+    exti->rtsr |= mask;
+    exti->ftsr |= mask;
 
     input_update = input_update_default;
 }
@@ -124,6 +127,8 @@ static uint8_t input_update_tb160(void)
 
 static void input_init_tb160(void)
 {
+    uint32_t mask;
+
     gpio_configure_pin(gpioa, 8+inp_sel0,  GPI_bus);
     gpio_configure_pin(gpiob, 3+inp_sel1,  GPI_bus);
     gpio_configure_pin(gpioa, 8+inp_dir,   GPI_bus);
@@ -131,13 +136,17 @@ static void input_init_tb160(void)
     gpio_configure_pin(gpiob, 3+inp_wgate, GPI_bus);
     gpio_configure_pin(gpioa, 8+inp_side,  GPI_bus);
 
-    /* PA[15:10,7:0] -> EXT[15:10,7:0], PB[9:8] -> EXT[9:8]. */
-    afio->exticr1 = afio->exticr2 = afio->exticr4 = 0x0000;
+    /* PA[15:10,7:1] -> EXT[15:10,7:1], PB[9:8] -> EXT[9:8]. 
+     * EXT0 belongs to the touch panel. */
+    afio->exticr1 &= 0x000f;
+    afio->exticr2 = afio->exticr4 = 0x0000;
     afio->exticr3 = 0x0011;
 
-    exti->imr = exti->rtsr = exti->ftsr =
-        m(8+inp_step) | m(8+inp_sel0) | m(3+inp_sel1)
+    mask = m(8+inp_step) | m(8+inp_sel0) | m(3+inp_sel1)
         | m(3+inp_wgate) | m(8+inp_side);
+    exti->imr |= mask;
+    exti->rtsr |= mask;
+    exti->ftsr |= mask;
 
     input_update = input_update_tb160;
 }
@@ -170,7 +179,7 @@ static void IRQ_input_changed(void)
     sel = !(inp & m(inp_sel0));
 
     /* DSKCHG asserts on any falling edge of STEP. We deassert on any edge. */
-    if ((changed & m(inp_step)) && sel && (dma_rd != NULL))
+    if ((changed & m(inp_step)) && sel && (drv->slot != NULL))
         floppy_change_outputs(m(pin_dskchg), O_FALSE);
     /* Handle step request. */
     if ((changed & inp & m(inp_step)) /* Rising edge on STEP */
@@ -192,13 +201,15 @@ static void IRQ_input_changed(void)
     /* Handle side change. */
     if (changed & m(inp_side)) {
         drv->head = !(inp & m(inp_side));
+        bus_event(EV_side, drv->head, stk_now());
+        lat_read_from(IOLAT_side_flux, stk_now());
         if (dma_rd != NULL) {
             rdata_stop();
         }
     }
 
     /* Handle write gate. */
-    if ((changed & m(inp_wgate)) && (dma_wr != NULL)
+    if ((changed & m(inp_wgate)) && (drv->image != NULL)
         && sel && drv->image->handler->write_track) {
         if (inp & m(inp_wgate)) {
             wdata_stop();
@@ -92,8 +92,13 @@
 extern const char font4x8[];
 extern const char font8x16[];
 
+/* The touch controller shares SPI1 and samples it from IRQ context: keep its 
+ * IRQ masked while we own the bus. */
+static uint32_t spi_oldpri;
+
 static void spi_acquire(void)
 {
+    spi_oldpri = IRQ_save(TOUCH_IRQ_PRI);
     spi->cr1 = SPI_CR1;
     set_pin(PIN_CS, 0);
 }
@@ -102,6 +107,7 @@ static void spi_release(void)
 {
     spi_quiesce(spi);
     set_pin(PIN_CS, 1);
+    IRQ_restore(spi_oldpri);
 }
 
 static void writecommand(uint8_t c)
@@ -140,96 +146,165 @@ static void set_addr_window(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
     writecommand(ILI9341_RAMWR);
 }
 
-void fill_rect(
-    uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t c)
+/* SPI1 TX DMA, used to stream pixel data. */
+#define dma_tx (dma1->ch3)
+#define DMA_TX_CH 3
+
+/* Pixel line buffers: one is rendered while the other is streamed by DMA. */
+static uint16_t linebuf[2][320];
+
+/* The 8x16 characters currently on screen. Only changed cells are redrawn. 
+ * Cells whose contents are unknown hold CELL_UNKNOWN. */
+#define CELL_UNKNOWN 0xff
+static uint8_t shadow[TFT_8x16_ROWS][TFT_8x16_COLS];
+
+/* Wait for any in-flight pixel DMA to complete. */
+static void dma_wait(void)
 {
-    unsigned int i;
-    set_addr_window(x, y, x+w-1, y+h-1);
-    set_pin(PIN_DCRS, 1);
-    spi_acquire();
-    spi_16bit_frame(spi);
-    for (i = 0; i < w*h; i++)
-        spi_xmit16(spi, c);
-    spi_8bit_frame(spi);
-    spi_release();
+    if (!(dma_tx.ccr & DMA_CCR_EN))
+        return;
+    while (!(dma1->isr & DMA_ISR_TCIF(DMA_TX_CH)))
+        cpu_relax();
+    dma_tx.ccr = 0;
+    dma1->ifcr = DMA_IFCR_CGIF(DMA_TX_CH);
 }
 
-void clear_screen(void)
+/* Stream @nr pixels from @p. If !@minc, the pixel at @p is repeated. */
+static void dma_start(const uint16_t *p, uint16_t nr, bool_t minc)
 {
-    fill_rect(0, 0, 320, 240, BG_COL);
+    dma_tx.cpar = (uint32_t)(unsigned long)&spi->dr;
+    dma_tx.cmar = (uint32_t)(unsigned long)p;
+    dma_tx.cndtr = nr;
+    dma_tx.ccr = (DMA_CCR_MSIZE_16BIT |
+                  DMA_CCR_PSIZE_16BIT |
+                  (minc ? DMA_CCR_MINC : 0) |
+                  DMA_CCR_DIR_M2P |
+                  DMA_CCR_EN);
 }
 
-static void draw_char_8x16(uint16_t x, uint16_t y, unsigned char c)
+static void pixels_begin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 {
-    uint8_t i, j;
-
-    set_addr_window(x, y, x+7, y+15);
-
+    set_addr_window(x0, y0, x1, y1);
     set_pin(PIN_DCRS, 1);
     spi_acquire();
     spi_16bit_frame(spi);
+    spi->cr2 = SPI_CR2_TXDMAEN;
+}
 
-    for (j = 0; j < 16; j++) {
-        int8_t k = font8x16[c*16+j];
-        for (i = 0; i < 8; i++) {
-            if (k < 0) {
-                spi_xmit16(spi, 0xffff);
-            } else {
-                spi_xmit16(spi, BG_COL);
-            }
-            k <<= 1;
-        }
-    }
-
+static void pixels_end(void)
+{
+    dma_wait();
+    spi->cr2 = 0;
     spi_8bit_frame(spi);
     spi_release();
 }
 
-void draw_string_8x16(uint16_t x, uint16_t y, const char *str)
+/* Forget the contents of 8x16 cells overlapping the given pixel rectangle. */
+static void invalidate_cells(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 {
-    y *= 16; /* 16px vertical spacing works well. */
-    while (*str && (x < TFT_8x16_COLS)) {
-        char c = *str++;
-        draw_char_8x16(x*8, y, !(c & 0x80) ? c : 0);
-        x++;
-    }
+    unsigned int i, j;
+    for (j = y/16; (j <= (y+h-1)/16) && (j < TFT_8x16_ROWS); j++)
+        for (i = x/8; (i <= (x+w-1)/8) && (i < TFT_8x16_COLS); i++)
+            shadow[j][i] = CELL_UNKNOWN;
 }
 
-static void draw_char_4x8(uint16_t x, uint16_t y, unsigned char c)
+void fill_rect(
+    uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t c)
 {
-    uint8_t i, j;
+    uint32_t nr = w*h;
+    uint16_t todo;
 
-    set_addr_window(x, y, x+3, y+7);
+    invalidate_cells(x, y, w, h);
 
-    set_pin(PIN_DCRS, 1);
-    spi_acquire();
-    spi_16bit_frame(spi);
+    pixels_begin(x, y, x+w-1, y+h-1);
+    while (nr != 0) {
+        todo = min_t(uint32_t, nr, 0xffff);
+        dma_wait();
+        dma_start(&c, todo, FALSE);
+        nr -= todo;
+    }
+    pixels_end();
+}
+
+void clear_screen(void)
+{
+    fill_rect(0, 0, 320, 240, BG_COL);
+    memset(shadow, ' ', sizeof(shadow));
+}
 
-    for (j = 0; j < 8; j++) {
-        int8_t k = font4x8[c*4+j/2];
-        if (j&1) k <<= 4; 
-        for (i = 0; i < 4; i++) {
-            if (k < 0) {
-                spi_xmit16(spi, 0xffff);
+/* Draw a run of @nr characters in a single address window. Each pixel row is 
+ * rendered into a line buffer while the previous row is sent by DMA. */
+static void draw_chars(
+    uint16_t x, uint16_t y, const char *str, unsigned int nr, bool_t small)
+{
+    unsigned int i, j, b, w = small ? 4 : 8, h = small ? 8 : 16;
+    uint16_t *p;
+    uint8_t c;
+    int8_t k;
+
+    pixels_begin(x, y, x+nr*w-1, y+h-1);
+
+    for (j = 0; j < h; j++) {
+        p = linebuf[j&1];
+        for (i = 0; i < nr; i++) {
+            c = str[i];
+            if (small) {
+                k = font4x8[c*4+j/2];
+                if (j&1) k <<= 4;
             } else {
-                spi_xmit16(spi, BG_COL);
+                k = font8x16[c*16+j];
+            }
+            for (b = 0; b < w; b++) {
+                *p++ = (k < 0) ? 0xffff : BG_COL;
+                k <<= 1;
             }
-            k <<= 1;
         }
+        dma_wait();
+        dma_start(linebuf[j&1], nr*w, TRUE);
     }
 
-    spi_8bit_frame(spi);
-    spi_release();
+    pixels_end();
 }
 
-void draw_string_4x8(uint16_t x, uint16_t y, const char *str)
+void draw_string_8x16(uint16_t x, uint16_t y, const char *str)
 {
-    y *= 10; /* 10px vertical spacing works well. */
-    while (*str && (x < TFT_4x8_COLS)) {
-        char c = *str++;
-        draw_char_4x8(x*4, y, !(c & 0x80) ? c : 0);
-        x++;
+    char text[TFT_8x16_COLS];
+    unsigned int i, first = TFT_8x16_COLS, last = 0;
+
+    if (y >= TFT_8x16_ROWS)
+        return;
+
+    /* Find the span of cells which differ from what is displayed. */
+    for (i = 0; str[i] && (x+i < TFT_8x16_COLS); i++) {
+        text[i] = !(str[i] & 0x80) ? str[i] : 0;
+        if (shadow[y][x+i] == (uint8_t)text[i])
+            continue;
+        shadow[y][x+i] = text[i];
+        first = min(first, i);
+        last = i;
     }
+
+    if (first > last)
+        return;
+
+    /* 16px vertical spacing works well. */
+    draw_chars((x+first)*8, y*16, &text[first], last+1-first, FALSE);
+}
+
+void draw_string_4x8(uint16_t x, uint16_t y, const char *str)
+{
+    char text[TFT_4x8_COLS];
+    unsigned int i;
+
+    for (i = 0; str[i] && (x+i < TFT_4x8_COLS); i++)
+        text[i] = !(str[i] & 0x80) ? str[i] : 0;
+
+    if (i == 0)
+        return;
+
+    /* 10px vertical spacing works well. */
+    invalidate_cells(x*4, y*10, i*4, 8);
+    draw_chars(x*4, y*10, text, i, TRUE);
 }
 
 /* Some cryptic command banging is required to set up the controller. 
@@ -263,6 +338,7 @@ const uint8_t init_seq[] = {
 void tft_init(void)
 {
     const uint8_t *init_p;
+    stk_time_t t;
     uint8_t i;
 
     /* Turn on the clocks. */
@@ -303,7 +379,9 @@ void tft_init(void)
     delay_ms(5);
 
     /* Clear the display, then switch it on. */
+    t = stk_now();
     clear_screen();
+    printk("TFT: Full-screen fill %u us\n", stk_diff(t, stk_now()) / STK_MHZ);
     writecommand(ILI9341_DISPON);
     delay_ms(100); /* wait for screen to refresh to black */
 }
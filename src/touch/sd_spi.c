@@ -171,7 +171,13 @@ static uint8_t send_cmd(uint8_t cmd, uint32_t arg)
     return res;
 }
 
-static bool_t datablock_recv(BYTE *buff, uint16_t bytes)
+/* Position within a scatter-gather list. */
+struct sg_cursor {
+    const DSEG *seg;
+    UINT off;
+};
+
+static bool_t datablock_recv_sg(struct sg_cursor *c, uint16_t bytes)
 {
     bool_t ok;
     uint8_t token;
@@ -189,11 +195,19 @@ static bool_t datablock_recv(BYTE *buff, uint16_t bytes)
     spi->crcpr = 0x1021; /* CRC-CCITT */
     spi->cr1 |= SPI_CR1_CRCEN;
 
-    /* Grab the data. */
+    /* Grab the data, straight into place. */
     while (bytes) {
         uint16_t w = spi_recv16(spi);
-        *buff++ = w >> 8;
-        *buff++ = w;
+        BYTE *p;
+        while (c->off >= c->seg->len) {
+            c->off -= c->seg->len;
+            c->seg++;
+        }
+        if ((p = c->seg->buff) != NULL) {
+            p[c->off] = w >> 8;
+            p[c->off+1] = w;
+        }
+        c->off += 2;
         bytes -= 2;
     }
 
@@ -208,6 +222,13 @@ static bool_t datablock_recv(BYTE *buff, uint16_t bytes)
     return ok;
 }
 
+static bool_t datablock_recv(BYTE *buff, uint16_t bytes)
+{
+    DSEG seg = { buff, bytes };
+    struct sg_cursor c = { &seg, 0 };
+    return datablock_recv_sg(&c, bytes);
+}
+
 static bool_t datablock_xmit(const BYTE *buff, uint8_t token)
 {
     uint8_t res, wc = 0;
@@ -404,9 +425,17 @@ DSTATUS disk_status (BYTE pdrv)
 
 DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
 {
+    DSEG seg = { buff, count * 512 };
+    return disk_read_sg(pdrv, &seg, 0, sector, count);
+}
+
+DRESULT disk_read_sg(BYTE pdrv, const DSEG *seg, UINT skip,
+                     DWORD sector, UINT count)
+{
+    stk32_time_t t = stk32_now();
     uint8_t retry = 0;
+    struct sg_cursor c;
     UINT todo;
-    BYTE *p;
 
     if (pdrv || !count)
         return RES_PARERR;
@@ -418,14 +447,15 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
 
     do {
         todo = count;
-        p = buff;
+        c.seg = seg;
+        c.off = skip;
 
         /* READ_{MULTIPLE,SINGLE}_BLOCK */
         if (send_cmd(CMD((count > 1) ? 18 : 17), sector) != 0)
             continue;
 
-        while (datablock_recv(p, 512) && --todo)
-            p += 512;
+        while (datablock_recv_sg(&c, 512) && --todo)
+            continue;
 
         /* STOP_TRANSMISSION */
         if (count > 1)
@@ -435,11 +465,13 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
 
     } while (todo && (++retry < 3));
 
+    iostats_read(t);
     return todo ? RES_ERROR : RES_OK;
 }
 
 DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
 {
+    stk32_time_t t = stk32_now();
     uint8_t retry = 0;
     UINT todo;
     const BYTE *p;
@@ -483,6 +515,7 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
 
     } while (todo && (++retry < 3));
 
+    iostats_write(t);
     return todo ? RES_ERROR : RES_OK;
 }
 
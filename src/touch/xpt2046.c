@@ -11,6 +11,8 @@
 
 #define GPIO_IRQ gpiob
 #define PIN_IRQ 0
+
+#define m(pin) (1u<<(pin))
 #define GPIO_CS gpioa
 #define PIN_CS 0
 
@@ -52,18 +54,21 @@ static void get_xy_samples(uint8_t nr, uint16_t *px, uint16_t *py)
     spi_release();
 }
 
-bool_t touch_get_xy(uint16_t *px, uint16_t *py)
+/* Queue of filtered touch coordinates, produced by IRQ_penirq(). */
+static struct {
+    uint16_t x, y;
+} touchq[8];
+static volatile uint8_t touchq_cons, touchq_prod;
+#define TOUCHQ_MASK (ARRAY_SIZE(touchq) - 1)
+
+/* While the pen is down we take a burst of samples this often. */
+#define SAMPLE_PERIOD stk_ms(20)
+static struct timer sample_timer;
+
+static bool_t filter_xy(uint16_t *x, uint16_t *y, uint16_t *px, uint16_t *py)
 {
-    uint16_t x[8], y[8];
     uint8_t i, j;
 
-    /* Get raw samples. Ensure PENIRQ was active throughout. */
-    if (gpio_read_pin(GPIO_IRQ, PIN_IRQ))
-        return FALSE;
-    get_xy_samples(8, x, y);
-    if (gpio_read_pin(GPIO_IRQ, PIN_IRQ))
-        return FALSE;
-
     /* Selection sort. Ignore the first sample; it's often an outlier. */
     for (i = 1; i < 7; i++) {
         for (j = i+1; j < 8; j++) {
@@ -92,6 +97,61 @@ bool_t touch_get_xy(uint16_t *px, uint16_t *py)
     return TRUE;
 }
 
+/* PENIRQ: EXTI0 (PB0 -> EXT0). Also pended by sample_timer while the pen is 
+ * down. Runs at the lowest priority, so sampling and filtering never delay 
+ * floppy interrupt work. */
+void IRQ_6(void) __attribute__((alias("IRQ_penirq")));
+#define PENIRQ_IRQ 6
+static void IRQ_penirq(void)
+{
+    uint16_t x[8], y[8], tx, ty;
+    bool_t ok;
+
+    /* Pen up? Then wait for the next PENIRQ edge. */
+    if (gpio_read_pin(GPIO_IRQ, PIN_IRQ))
+        goto out;
+
+    /* Get raw samples. Ensure PENIRQ was active throughout. */
+    get_xy_samples(8, x, y);
+    ok = !gpio_read_pin(GPIO_IRQ, PIN_IRQ);
+
+    if (ok && filter_xy(x, y, &tx, &ty)
+        && ((uint8_t)(touchq_prod - touchq_cons) <= TOUCHQ_MASK)) {
+        touchq[touchq_prod & TOUCHQ_MASK].x = tx;
+        touchq[touchq_prod & TOUCHQ_MASK].y = ty;
+        barrier(); /* write the sample /then/ publish it */
+        touchq_prod++;
+    }
+
+    /* Keep sampling while the pen is down. */
+    timer_set(&sample_timer, stk_add(stk_now(), SAMPLE_PERIOD));
+
+out:
+    /* Sampling toggles PENIRQ: discard the resulting edges. */
+    exti->pr = m(PIN_IRQ);
+    IRQx_clear_pending(PENIRQ_IRQ);
+}
+
+static void sample_timer_fn(void *unused)
+{
+    IRQx_set_pending(PENIRQ_IRQ);
+}
+
+bool_t touch_get_xy(uint16_t *px, uint16_t *py)
+{
+    uint8_t cons = touchq_cons;
+
+    if (cons == touchq_prod)
+        return FALSE;
+
+    *px = touchq[cons & TOUCHQ_MASK].x;
+    *py = touchq[cons & TOUCHQ_MASK].y;
+    barrier(); /* read the sample /then/ release it */
+    touchq_cons = cons + 1;
+
+    return TRUE;
+}
+
 void touch_init(void)
 {
     uint16_t x, y;
@@ -104,6 +164,17 @@ void touch_init(void)
 
     /* Set PD0=PD1=0 (power-saving mode; PENIRQ active). */
     get_xy_samples(1, &x, &y);
+
+    timer_init(&sample_timer, sample_timer_fn, NULL);
+
+    /* PENIRQ falls when the panel is touched: PB0 -> EXT0. */
+    afio->exticr1 = (afio->exticr1 & ~0xfu) | 0x1u;
+    exti->ftsr |= m(PIN_IRQ);
+    exti->imr |= m(PIN_IRQ);
+    exti->pr = m(PIN_IRQ);
+    IRQx_clear_pending(PENIRQ_IRQ);
+    IRQx_set_prio(PENIRQ_IRQ, TOUCH_IRQ_PRI);
+    IRQx_enable(PENIRQ_IRQ);
 }
 
 /*
@@ -7,6 +7,8 @@
  *  - Press both Gotek buttons to start the update process.
  *  - Requires a USB flash drive containing exactly one update file
  *    named "FF_Gotek*.upd" (* = wildcard).
+ *  - The update file may be compressed (see scripts/mk_update.py). It is
+ *    decompressed on the fly, both to check the CRC and to program flash.
  * 
  * Status messages:
  *  uPd -> Waiting for buttons to release
@@ -67,6 +69,30 @@ static enum {
     FC_bad_prg
 } fail_code;
 
+/* Update-file streaming state. Both passes over the file (CRC check, then 
+ * programming) feed the same (decompressed) byte stream to a sink. */
+static uint8_t buf[2048];
+static uint16_t upd_crc;
+static uint32_t upd_len, upd_tail, prg_addr;
+
+/* Compressed input reader. The stream is followed by a 4-byte footer, 
+ * which is read (and CRCed) but not returned. */
+static struct {
+    FIL *fp;
+    uint32_t left, end;
+    UINT pos, nr;
+    uint16_t crc;
+} in;
+
+/* Compressed stream format (LZSS): Each flag byte, read LSB first, 
+ * describes the following 8 tokens. A set bit is a literal byte. A clear 
+ * bit is a 2-byte match: distance-1 in the low byte and top nibble of the 
+ * second byte (1..4096), and length-3 in its low nibble (3..18). 
+ * Decompressed data passes through a 4kB ring, which is also the match 
+ * window. Each time half the ring fills it is passed to the sink. */
+#define LZ_RING 4096
+static uint8_t lz_ring[LZ_RING];
+
 uint8_t board_id;
 
 static void canary_init(void)
@@ -87,12 +113,130 @@ static void erase_old_firmware(void)
         fpec_page_erase(p);
 }
 
+static void in_fill(void)
+{
+    in.nr = min_t(uint32_t, sizeof(buf), in.left);
+    F_read(in.fp, buf, in.nr, NULL);
+    in.crc = crc16_ccitt(buf, in.nr, in.crc);
+    in.left -= in.nr;
+    in.pos = 0;
+}
+
+static int in_getc(void)
+{
+    if (in.end == 0)
+        return -1;
+    if (in.pos == in.nr)
+        in_fill();
+    in.end--;
+    return buf[in.pos++];
+}
+
+static void lz_decompress(FIL *fp, void (*sink)(const uint8_t *, UINT))
+{
+    uint32_t out = 0;
+    unsigned int flags = 0, dist, len;
+    int c, c1;
+
+    in.fp = fp;
+    in.left = f_size(fp);
+    in.end = f_size(fp) - 4;
+    in.pos = in.nr = 0;
+    in.crc = 0xffff;
+
+#define emit(_c) do {                                               \
+    uint8_t __c = (_c);                                             \
+    lz_ring[out++ & (LZ_RING-1)] = __c;                             \
+    if (!(out & (LZ_RING/2-1)))                                     \
+        (*sink)(&lz_ring[(out - LZ_RING/2) & (LZ_RING-1)], LZ_RING/2);  \
+} while (0)
+
+    while (!fail_code) {
+        flags >>= 1;
+        if (!(flags & 0x100)) {
+            if ((c = in_getc()) < 0)
+                break;
+            flags = c | 0xff00;
+        }
+        if ((c = in_getc()) < 0)
+            break;
+        if (flags & 1) {
+            emit(c);
+            continue;
+        }
+        if ((c1 = in_getc()) < 0)
+            goto bad;
+        dist = (c | ((c1 & 0xf0) << 4)) + 1;
+        len = (c1 & 0x0f) + 3;
+        if (dist > out)
+            goto bad;
+        while (len--)
+            emit(lz_ring[(out - dist) & (LZ_RING-1)]);
+    }
+
+#undef emit
+
+    /* Flush the partial ring half and read the footer, to complete the 
+     * file CRC. */
+    len = out & (LZ_RING/2-1);
+    if (!fail_code && len)
+        (*sink)(&lz_ring[(out - len) & (LZ_RING-1)], len);
+    while (in.left)
+        in_fill();
+    return;
+
+bad:
+    fail_code = FC_bad_file;
+}
+
+/* Feed the update image to @sink, decompressing if necessary. */
+static void upd_stream(FIL *fp, bool_t compressed,
+                       void (*sink)(const uint8_t *, UINT))
+{
+    UINT nr;
+
+    F_lseek(fp, 0);
+    if (compressed) {
+        lz_decompress(fp, sink);
+        return;
+    }
+    while (!f_eof(fp) && !fail_code) {
+        nr = min_t(UINT, sizeof(buf), f_size(fp) - f_tell(fp));
+        F_read(fp, buf, nr, NULL);
+        (*sink)(buf, nr);
+    }
+}
+
+static void crc_sink(const uint8_t *p, UINT nr)
+{
+    UINT i;
+    if ((upd_len += nr) > (FIRMWARE_END-FIRMWARE_START)) {
+        fail_code = FC_bad_file;
+        return;
+    }
+    upd_crc = crc16_ccitt(p, nr, upd_crc);
+    for (i = (nr > 4) ? nr - 4 : 0; i < nr; i++)
+        upd_tail = (upd_tail << 8) | p[i];
+}
+
+static void prg_sink(const uint8_t *p, UINT nr)
+{
+    fpec_write(p, nr, prg_addr);
+    if (memcmp((void *)prg_addr, p, nr) != 0) {
+        /* Byte-by-byte verify failed. */
+        fail_code = FC_bad_prg;
+        return;
+    }
+    prg_addr += nr;
+}
+
 static void msg_display(const char *p)
 {
     printk("[%s]\n", p);
     switch (display_mode) {
     case DM_LED_3DIG:
         led_3dig_write(p);
+        led_3dig_sync();
         break;
     case DM_LCD_1602:
         lcd_write(6, 1, 0, p);
@@ -109,12 +253,8 @@ int update(void)
     static FILINFO fno;
     static char update_fname[FF_MAX_LFN+1];
 
-    /* Our file buffer. Again, off stack. */
-    static uint8_t buf[2048];
-
-    uint32_t p;
     uint16_t footer[2], crc;
-    UINT i, nr;
+    bool_t compressed = FALSE;
     FIL *fp = &file;
 
     /* Find the update file, confirming that it exists and there is no 
@@ -137,35 +277,44 @@ int update(void)
     /* Open and sanity-check the file. */
     msg_display(" RD");
     F_open(fp, update_fname, FA_READ);
+    /* Check signature in footer: "FZ" marks a compressed file. */
+    if (f_size(fp) >= sizeof(footer)) {
+        F_lseek(fp, f_size(fp) - sizeof(footer));
+        F_read(fp, footer, sizeof(footer), NULL);
+        compressed = (be16toh(footer[0]) == 0x465a/* "FZ" */);
+    }
     /* Check size. */
-    fail_code = ((f_size(fp) < 1024)
+    fail_code = ((f_size(fp) < (compressed ? 16 : 1024))
                  || (f_size(fp) > (FIRMWARE_END-FIRMWARE_START))
-                 || (f_size(fp) & 3))
+                 || (!compressed && (f_size(fp) & 3)))
         ? FC_bad_file : 0;
-    printk("%u bytes: %s\n", f_size(fp), fail_code ? "BAD" : "OK");
+    printk("%u bytes%s: %s\n", f_size(fp), compressed ? " (compressed)" : "",
+           fail_code ? "BAD" : "OK");
     if (fail_code)
         goto fail;
-    /* Check signature in footer. */
-    F_lseek(fp, f_size(fp) - sizeof(footer));
-    F_read(fp, footer, sizeof(footer), NULL);
-    if (be16toh(footer[0]) != 0x4659/* "FY" */) {
+    if (!compressed && (be16toh(footer[0]) != 0x4659/* "FY" */)) {
         fail_code = FC_bad_file;
         goto fail;
     }
 
-    /* Check the CRC-CCITT. */
+    /* Check the CRC-CCITT, over the decompressed image. */
     msg_display("CRC");
-    crc = 0xffff;
-    F_lseek(fp, 0);
-    for (i = 0; !f_eof(fp); i++) {
-        nr = min_t(UINT, sizeof(buf), f_size(fp) - f_tell(fp));
-        F_read(&file, buf, nr, NULL);
-        crc = crc16_ccitt(buf, nr, crc);
-    }
-    if (crc != 0) {
+    upd_crc = 0xffff;
+    upd_len = 0;
+    upd_stream(fp, compressed, crc_sink);
+    if (fail_code)
+        goto fail;
+    if ((upd_crc != 0) || (compressed && (in.crc != 0))) {
         fail_code = FC_bad_crc;
         goto fail;
     }
+    /* A decompressed image must itself be a valid uncompressed image. */
+    if (compressed && ((upd_len < 1024) || (upd_len & 3)
+                       || ((upd_tail >> 16) != 0x4659/* "FY" */))) {
+        fail_code = FC_bad_file;
+        goto fail;
+    }
+    printk("Image: %u bytes\n", upd_len);
 
     /* Erase the old firmware. */
     msg_display("CLR");
@@ -175,24 +324,13 @@ int update(void)
 
     /* Program the new firmware. */
     msg_display("PRG");
-    crc = 0xffff;
-    F_lseek(fp, 0);
-    p = FIRMWARE_START;
-    for (i = 0; !f_eof(fp); i++) {
-        nr = min_t(UINT, sizeof(buf), f_size(fp) - f_tell(fp));
-        F_read(&file, buf, nr, NULL);
-        fpec_write(buf, nr, p);
-        if (memcmp((void *)p, buf, nr) != 0) {
-            /* Byte-by-byte verify failed. */
-            fail_code = FC_bad_prg;
-            goto fail;
-        }
-        p += nr;
-    }
+    prg_addr = FIRMWARE_START;
+    upd_stream(fp, compressed, prg_sink);
+    if (fail_code)
+        goto fail;
 
     /* Verify the new firmware (CRC-CCITT). */
-    p = FIRMWARE_START;
-    crc = crc16_ccitt((void *)p, f_size(fp), 0xffff);
+    crc = crc16_ccitt((void *)FIRMWARE_START, upd_len, 0xffff);
     if (crc) {
         /* CRC verify failed. */
         fail_code = FC_bad_prg;
@@ -212,6 +350,7 @@ static void display_setting(bool_t on)
     switch (display_mode) {
     case DM_LED_3DIG:
         led_3dig_display_setting(on);
+        led_3dig_sync();
         break;
     case DM_LCD_1602:
         lcd_backlight(on);
@@ -24,9 +24,28 @@ void filename_extension(const char *filename, char *extension, size_t size)
     extension[i] = '\0';
 }
 
+/* The memory primitives below move whole words where they can, and fall 
+ * back to bytes only at the unaligned edges. The bulk loops handle four 
+ * words per iteration, which the compiler turns into LDM/STM. Cortex-M3 
+ * permits unaligned LDR/STR (but not LDM/STM), so a source whose alignment 
+ * differs from the destination's is accessed through a packed type. */
+struct __packed unaligned_word { uint32_t x; };
+
 void *memset(void *s, int c, size_t n)
 {
-    char *p = s;
+    uint8_t *p = s;
+    uint32_t *q, w;
+
+    if (n >= 8) {
+        for (; (unsigned long)p & 3; n--)
+            *p++ = c;
+        w = (uint8_t)c * 0x01010101u;
+        for (q = (uint32_t *)p; n >= 16; n -= 16, q += 4)
+            q[0] = q[1] = q[2] = q[3] = w;
+        for (; n >= 4; n -= 4)
+            *q++ = w;
+        p = (uint8_t *)q;
+    }
     while (n--)
         *p++ = c;
     return s;
@@ -34,8 +53,28 @@ void *memset(void *s, int c, size_t n)
 
 void *memcpy(void *dest, const void *src, size_t n)
 {
-    char *p = dest;
-    const char *q = src;
+    uint8_t *p = dest;
+    const uint8_t *q = src;
+
+    if (n >= 8) {
+        for (; (unsigned long)p & 3; n--)
+            *p++ = *q++;
+        if (!((unsigned long)q & 3)) {
+            uint32_t *_p = (uint32_t *)p;
+            const uint32_t *_q = (const uint32_t *)q;
+            for (; n >= 16; n -= 16, _p += 4, _q += 4) {
+                uint32_t w0 = _q[0], w1 = _q[1], w2 = _q[2], w3 = _q[3];
+                _p[0] = w0; _p[1] = w1; _p[2] = w2; _p[3] = w3;
+            }
+            for (; n >= 4; n -= 4)
+                *_p++ = *_q++;
+            p = (uint8_t *)_p;
+            q = (const uint8_t *)_q;
+        } else {
+            for (; n >= 4; n -= 4, p += 4, q += 4)
+                *(uint32_t *)p = ((const struct unaligned_word *)q)->x;
+        }
+    }
     while (n--)
         *p++ = *q++;
     return dest;
@@ -43,12 +82,21 @@ void *memcpy(void *dest, const void *src, size_t n)
 
 void *memmove(void *dest, const void *src, size_t n)
 {
-    char *p;
-    const char *q;
-    if (dest < src)
+    uint8_t *p;
+    const uint8_t *q;
+    if ((dest < src) || ((const uint8_t *)src + n <= (uint8_t *)dest))
         return memcpy(dest, src, n);
+    /* Overlapping, with dest above src: copy downwards. */
     p = dest; p += n;
     q = src; q += n;
+    if (n >= 8) {
+        for (; (unsigned long)p & 3; n--)
+            *--p = *--q;
+        for (; n >= 4; n -= 4) {
+            p -= 4; q -= 4;
+            *(uint32_t *)p = ((const struct unaligned_word *)q)->x;
+        }
+    }
     while (n--)
         *--p = *--q;
     return dest;
@@ -56,8 +104,19 @@ void *memmove(void *dest, const void *src, size_t n)
 
 int memcmp(const void *s1, const void *s2, size_t n)
 {
-    const char *_s1 = s1;
-    const char *_s2 = s2;
+    const uint8_t *_s1 = s1;
+    const uint8_t *_s2 = s2;
+    if ((n >= 8) && !(((unsigned long)_s1 ^ (unsigned long)_s2) & 3)) {
+        for (; (unsigned long)_s1 & 3; n--) {
+            int diff = *_s1++ - *_s2++;
+            if (diff)
+                return diff;
+        }
+        /* Skip matching words; any mismatch is resolved bytewise below. */
+        for (; n >= 4; n -= 4, _s1 += 4, _s2 += 4)
+            if (*(const uint32_t *)_s1 != *(const uint32_t *)_s2)
+                break;
+    }
     while (n--) {
         int diff = *_s1++ - *_s2++;
         if (diff)